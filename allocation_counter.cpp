@@ -0,0 +1,22 @@
+#include <cstdlib>
+#include <new>
+
+#include "allocation_counter.h"
+
+thread_local uint64_t thread_allocations = 0;
+
+void* operator new(std::size_t size) {
+    thread_allocations += 1;
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) throw std::bad_alloc();
+
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
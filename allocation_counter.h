@@ -0,0 +1,13 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+/*
+ *  Heap allocations made by the current thread. Programs linking allocation_counter.cpp have the global
+ *  operator new replaced just to count them, so that the server can show that the request path of a worker
+ *  allocates nothing once it is warmed up, and benchmarks can report allocations per operation.
+ */
+extern thread_local uint64_t thread_allocations;
+
+#endif // ALLOCATION_COUNTER_H
@@ -0,0 +1,68 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+#include <vector>
+
+const uint8_t HISTOGRAM_SUB_BUCKET_BITS = 5;
+const uint32_t HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+const uint32_t HISTOGRAM_BUCKETS = (64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS;
+
+/*
+ *  Log-linear histogram in the style of HdrHistogram. Values below 2^5 have their own buckets, every next power
+ *  of two is split into 32 buckets, so recorded values are rounded down by at most about 3 percent.
+ */
+class LatencyHistogram {
+private:
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+
+    static uint32_t get_bucket(uint64_t value) {
+        if (value < HISTOGRAM_SUB_BUCKETS) return value;
+        int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BUCKET_BITS;
+
+        return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+    }
+
+    static uint64_t get_bucket_value(uint32_t bucket) {
+        if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+        uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+
+        return uint64_t(bucket - shift * HISTOGRAM_SUB_BUCKETS) << shift;
+    }
+
+public:
+    LatencyHistogram() : buckets(HISTOGRAM_BUCKETS) {}
+
+    [[nodiscard]] uint64_t get_count() const {
+        return count;
+    }
+
+    void record(uint64_t value) {
+        buckets[get_bucket(value)] += 1;
+        count += 1;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            buckets[i] += other.buckets[i];
+        }
+
+        count += other.count;
+    }
+
+    [[nodiscard]] uint64_t get_percentile(double percentile) const {
+        auto rank = (uint64_t) (percentile / 100 * count + 0.5);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+
+        for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= rank) return get_bucket_value(i);
+        }
+
+        return 0;
+    }
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -18,9 +18,37 @@ class Client:
     def receive_message(self):
         return self.socket.recvfrom(1 << 16)[0]
 
+    # returns None if nothing arrives within timeout seconds
+    def receive_message_or_none(self, timeout=0.5):
+        self.socket.settimeout(timeout)
+        try:
+            return self.receive_message()
+        except socket.timeout:
+            return None
+        finally:
+            self.socket.settimeout(None)
+
     def get_events(self):
         self.send_message(struct.pack('!B', 1))
+        return self.parse_events(self.receive_message())
+
+    def get_events_page(self, first_event_id, only_available=False):
+        self.send_message(struct.pack('!BIB', 7, first_event_id, 1 if only_available else 0))
+        return self.parse_events(self.receive_message())
+
+    def get_events_delta(self, version):
+        self.send_message(struct.pack('!BQ', 8, version))
         data = self.receive_message()
+        assert struct.unpack('!B', data[0:1])[0] == 9
+        assert (len(data) - 10) % 6 == 0
+
+        class EventsDeltaInfo(Printable): pass
+        info = EventsDeltaInfo()
+        info.full, info.version = struct.unpack('!BQ', data[1:10])
+        info.counts = [struct.unpack('!IH', data[i : i + 6]) for i in range(10, len(data), 6)]
+        return info
+
+    def parse_events(self, data):
         assert struct.unpack('!B', data[0:1])[0] == 2
         data = data[1:]
         ret = []
@@ -69,3 +97,20 @@ class Client:
                 assert (ord('A') <= c and c <= ord('Z')) or (ord('0') <= c and c <= ord('9'))
             info.tickets.append(ticket.decode('utf-8'))
         return info
+
+    def validate_ticket(self, ticket):
+        self.send_message(struct.pack('!B7s', 10, ticket.encode()))
+        data = self.receive_message()
+        assert struct.unpack('!B', data[0:1])[0] == 11
+        assert len(data) == 1 + 7 + 1 + 4 + 4
+
+        class TicketStatusInfo(Printable): pass
+        info = TicketStatusInfo()
+        info.ticket, info.valid, info.reservation_id, info.event_id = struct.unpack('!7sBII', data[1:])
+        info.ticket = info.ticket.decode('utf-8')
+        return info
+
+    # the admin socket answers any datagram with the stats report of its worker
+    def get_stats_report(self, admin_port):
+        self.socket.sendto(b'\0', (self.server_addr[0], admin_port))
+        return self.receive_message().decode('utf-8')
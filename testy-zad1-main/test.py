@@ -3,6 +3,20 @@ from test_small_correctness import test_small_correctness
 from test_big_correctness import test_big_correctness
 from test_limits import test_limits
 from test_reservation_timing_out import test_reservation_timing_out
+from test_batches import test_batches
+from test_workers import test_workers
+from test_snapshot import test_snapshot
+from test_journal import test_journal
+from test_events_page import test_events_page
+from test_events_delta import test_events_delta
+from test_rate_limits import test_rate_limits
+from test_client_limit import test_client_limit
+from test_validate_ticket import test_validate_ticket
+from test_tickets_cache import test_tickets_cache
+from test_retention import test_retention
+from test_reload import test_reload
+from test_priority import test_priority
+from test_stats import test_stats
 import os
 
 if __name__ == '__main__':
@@ -14,6 +28,20 @@ if __name__ == '__main__':
         test_big_correctness,
         test_limits,
         test_reservation_timing_out,
+        test_batches,
+        test_workers,
+        test_snapshot,
+        test_journal,
+        test_events_page,
+        test_events_delta,
+        test_rate_limits,
+        test_client_limit,
+        test_validate_ticket,
+        test_tickets_cache,
+        test_retention,
+        test_reload,
+        test_priority,
+        test_stats,
     ]
     
     try:
@@ -0,0 +1,53 @@
+from basic_client import Client
+from server_wrap import start_server_with_params
+import struct
+
+def test_batch_replies(client):
+    r = client.get_reservation(1, 2)
+    requests = [
+        struct.pack('!B', 1),
+        struct.pack('!BIH', 3, 1, 1),
+        struct.pack('!BI48s', 5, r.reservation_id, r.cookie.encode()),
+        struct.pack('!BIH', 3, 7, 1),
+        struct.pack('!BIH', 3, 0, 0),
+    ] * 4
+
+    for message in requests:
+        client.send_message(message)
+
+    message_ids = [client.receive_message()[0] for _ in requests]
+    assert sorted(message_ids) == sorted([2, 4, 6, 255, 255] * 4)
+    assert client.receive_message_or_none() is None
+
+    assert [e.ticket_count for e in client.get_events()] == [123, 32 - 2 - 4, 0]
+
+def test_batch_malformed(client):
+    malformed = [
+        b'\x01\x00',
+        struct.pack('!BI', 3, 0),
+        b'\x05' + b'\x00' * 10,
+        b'\x01' + b'\x00' * 1000,
+        b'\x02',
+        b'\x04',
+        b'\xff',
+    ]
+
+    for message in malformed:
+        client.send_message(message)
+    client.send_message(struct.pack('!B', 1))
+
+    assert client.receive_message()[0] == 2
+    assert client.receive_message_or_none() is None
+
+def test_batches():
+    server = start_server_with_params(['-f', 'event_files/events_example', '-b', '16'])
+    client = Client()
+
+    test_batch_replies(client)
+    test_batch_malformed(client)
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_batches()
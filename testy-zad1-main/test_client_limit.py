@@ -0,0 +1,49 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params, get_return_code_of_server_with_params
+import time
+
+EVENTS_FILE = 'event_files/events_example'
+TIMEOUT = 1
+
+def expect_bad_request(client, event_id, ticket_count):
+    try:
+        client.get_reservation(event_id, ticket_count)
+        assert False
+    except Response255Exception:
+        pass
+
+def test_holdings(client):
+    collected = client.get_reservation(1, 3)
+    client.get_reservation(1, 2)
+    expect_bad_request(client, 1, 1)
+    expect_bad_request(client, 0, 1)
+    assert [e.ticket_count for e in client.get_events()] == [123, 27, 0]
+
+    client.get_tickets(collected.reservation_id, collected.cookie)
+    client.get_reservation(0, 3)
+    expect_bad_request(client, 0, 1)
+
+    other_client = Client()
+    other_client.socket.bind(('127.0.0.2', 0))
+    other_client.get_reservation(1, 5)
+    expect_bad_request(other_client, 1, 1)
+
+    time.sleep(TIMEOUT + 0.5)
+    client.get_reservation(0, 5)
+    expect_bad_request(client, 0, 1)
+
+def test_client_limit():
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-m', '0']) == 1
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-m', '1073741825']) == 1
+
+    server = start_server_with_params(['-f', EVENTS_FILE, '-m', '5', '-t', str(TIMEOUT)])
+    client = Client()
+
+    expect_bad_request(client, 0, 6)
+    test_holdings(client)
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_client_limit()
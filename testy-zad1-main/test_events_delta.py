@@ -0,0 +1,88 @@
+from basic_client import Client
+from server_wrap import start_server, start_server_with_params
+from event_files.generate_file import generate_file
+import struct
+
+MAX_DATAGRAM_SIZE = 65507
+# message_id = 1, full = 1, version = 8; event_id = 4, ticket_count = 2
+MAX_DELTA_COUNTS = (MAX_DATAGRAM_SIZE - 10) // 6
+MANY_EVENTS = 12000
+
+DELTA_CHANGES = 0
+DELTA_FULL = 1
+DELTA_TRUNCATED = 2
+
+def many_events(file):
+    for i in range(MANY_EVENTS):
+        file.write('wydarzenie ' + str(i) + '\n' + str(i % 100) + '\n')
+
+def stop(server):
+    server.terminate()
+    server.communicate()
+
+def test_deltas(client):
+    delta = client.get_events_delta(0)
+    assert delta.full == DELTA_FULL
+    assert delta.counts == [(0, 123), (1, 32), (2, 0)]
+
+    client.get_reservation(1, 2)
+    changed = client.get_events_delta(delta.version)
+    assert changed.full == DELTA_CHANGES
+    assert changed.counts == [(1, 30)]
+    assert changed.version > delta.version
+
+    unchanged = client.get_events_delta(changed.version)
+    assert unchanged.full == DELTA_CHANGES
+    assert unchanged.counts == []
+    assert unchanged.version == changed.version
+
+    client.get_reservation(0, 1)
+    client.get_reservation(0, 1)
+    assert client.get_events_delta(changed.version).counts == [(0, 121)]
+
+    assert client.get_events_delta(changed.version + 1000).full == DELTA_FULL
+    return changed.version
+
+def test_malformed_deltas(client):
+    client.send_message(struct.pack('!BI', 8, 0))
+    client.send_message(struct.pack('!BQB', 8, 0, 0))
+    client.send_message(b'\x08')
+    assert client.receive_message_or_none() is None
+
+def test_truncated_delta(client):
+    delta = client.get_events_delta(0)
+    assert delta.full == DELTA_TRUNCATED
+    assert delta.counts == [(i, i % 100) for i in range(MAX_DELTA_COUNTS)]
+
+    rest = client.get_events_page(MAX_DELTA_COUNTS)
+    assert rest[0].event_id == MAX_DELTA_COUNTS
+    assert rest[-1].event_id == MANY_EVENTS - 1
+
+def test_events_delta():
+    client = Client()
+
+    server = start_server('event_files/events_example')
+    version = test_deltas(client)
+    test_malformed_deltas(client)
+    stop(server)
+
+    server = start_server('event_files/events_example')
+    delta = client.get_events_delta(version)
+    assert delta.full == DELTA_FULL
+    assert delta.counts == [(0, 123), (1, 32), (2, 0)]
+    stop(server)
+
+    server = start_server_with_params(['-f', 'event_files/events_example', '-w', '2'])
+    delta = client.get_events_delta(0)
+    client.get_reservation(1, 2)
+    delta = client.get_events_delta(delta.version)
+    assert delta.full == DELTA_FULL
+    assert delta.counts == [(0, 123), (1, 30), (2, 0)]
+    stop(server)
+
+    server = start_server(generate_file(many_events))
+    test_truncated_delta(client)
+    stop(server)
+
+if __name__ == '__main__':
+    test_events_delta()
@@ -0,0 +1,65 @@
+from basic_client import Client
+from server_wrap import start_server
+from event_files.generate_file import generate_file
+import struct
+
+EVENT_COUNT = 2000
+MAX_DATAGRAM_SIZE = 65507
+# event_id = 4, ticket_count = 2, description_length = 1, description = 80
+EVENTS_PER_PAGE = (MAX_DATAGRAM_SIZE - 1) // (4 + 2 + 1 + 80)
+
+def ticket_count(event_id):
+    return event_id % 3
+
+def paged_events(file):
+    for i in range(EVENT_COUNT):
+        file.write(('wydarzenie ' + str(i)).ljust(80, '.') + '\n' + str(ticket_count(i)) + '\n')
+
+def read_all_pages(client, only_available):
+    events = []
+    while True:
+        first_event_id = events[-1].event_id + 1 if events else 0
+        page = client.get_events_page(first_event_id, only_available)
+        if not page:
+            return events
+        assert len(page) <= EVENTS_PER_PAGE
+        events += page
+
+def test_pages(client):
+    assert len(client.get_events_page(0)) == EVENTS_PER_PAGE
+
+    events = read_all_pages(client, False)
+    assert [e.event_id for e in events] == list(range(EVENT_COUNT))
+    for e in events:
+        assert e.ticket_count == ticket_count(e.event_id)
+        assert e.description == ('wydarzenie ' + str(e.event_id)).ljust(80, '.')
+
+    available = read_all_pages(client, True)
+    assert [e.event_id for e in available] == [i for i in range(EVENT_COUNT) if ticket_count(i) > 0]
+
+    reserved_event_id = 1001
+    client.get_reservation(reserved_event_id, ticket_count(reserved_event_id))
+    assert client.get_events_page(reserved_event_id)[0].ticket_count == 0
+    assert reserved_event_id not in [e.event_id for e in client.get_events_page(reserved_event_id - 1, True)]
+
+    assert client.get_events_page(EVENT_COUNT) == []
+    assert client.get_events_page(0xffffffff, True) == []
+
+def test_malformed_pages(client):
+    client.send_message(struct.pack('!BI', 7, 0))
+    client.send_message(struct.pack('!BIBB', 7, 0, 0, 0))
+    client.send_message(b'\x07')
+    assert client.receive_message_or_none() is None
+
+def test_events_page():
+    server = start_server(generate_file(paged_events))
+    client = Client()
+
+    test_pages(client)
+    test_malformed_pages(client)
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_events_page()
@@ -0,0 +1,84 @@
+from basic_client import Client
+from server_wrap import start_server_with_params, get_return_code_of_server_with_params
+import os, shutil, signal, struct, tempfile, time
+
+JOURNAL_HEADER = '=8sIIQ'
+# first_ticket_number, time, reservation_id, event_id, ticket_count, type, cookie, client_address
+JOURNAL_RECORD = '=QQIIHB48sxI'
+JOURNAL_RESERVED = 1
+
+def kill(server):
+    server.send_signal(signal.SIGKILL)
+    server.communicate()
+
+def test_replay(params):
+    server = start_server_with_params(params)
+    client = Client()
+
+    r1 = client.get_reservation(0, 3)
+    r2 = client.get_reservation(1, 4)
+    tickets = client.get_tickets(r2.reservation_id, r2.cookie).tickets
+    kill(server)
+
+    # journal only
+    server = start_server_with_params(params)
+    assert [e.ticket_count for e in client.get_events()] == [120, 28, 0]
+    assert client.get_tickets(r2.reservation_id, r2.cookie).tickets == tickets
+    r3 = client.get_reservation(1, 2)
+    assert r3.reservation_id == r2.reservation_id + 1
+    server.send_signal(signal.SIGTERM)
+    server.communicate()
+    assert server.returncode == 0
+
+    # snapshot and the journal which continues it
+    server = start_server_with_params(params)
+    assert client.get_tickets(r1.reservation_id, r1.cookie).ticket_count == 3
+    r4 = client.get_reservation(0, 5)
+    kill(server)
+
+    server = start_server_with_params(params)
+    assert [e.ticket_count for e in client.get_events()] == [115, 26, 0]
+    assert client.get_tickets(r1.reservation_id, r1.cookie).ticket_count == 3
+    assert client.get_tickets(r3.reservation_id, r3.cookie).ticket_count == 2
+    assert client.get_tickets(r4.reservation_id, r4.cookie).ticket_count == 5
+    kill(server)
+
+def write_journal(filename, ticket_counts, torn=False):
+    with open(filename, 'wb') as journal:
+        journal.write(struct.pack(JOURNAL_HEADER, b'TKTJRNL\0', 1, 0, 0))
+        for i, ticket_count in enumerate(ticket_counts):
+            journal.write(struct.pack(JOURNAL_RECORD, 0, int(time.time()) + 30, 1000000 + i, 0, ticket_count,
+                                      JOURNAL_RESERVED, b'a' * 48, 0))
+        if torn:
+            journal.write(b'\x00' * 10)
+
+def test_rejects_corrupted(directory):
+    events = os.path.join(directory, 'events')
+    with open(events, 'w') as events_file:
+        events_file.write('big event\n65535\n')
+    journal = os.path.join(directory, 'corrupted')
+    params = ['-f', events, '-j', journal]
+
+    write_journal(journal, [5, 7], torn=True)
+    server = start_server_with_params(params)
+    assert Client().get_events()[0].ticket_count == 65535 - 12
+    server.terminate()
+    server.communicate()
+
+    for ticket_counts in [[0], [5, 0], [9358], [65535]]:
+        write_journal(journal, ticket_counts)
+        assert get_return_code_of_server_with_params(params) == 1
+
+def test_journal():
+    directory = tempfile.mkdtemp()
+    params = ['-f', 'event_files/events_example', '-t', '30',
+              '-s', os.path.join(directory, 'snapshot'), '-j', os.path.join(directory, 'journal')]
+
+    try:
+        test_replay(params)
+        test_rejects_corrupted(directory)
+    finally:
+        shutil.rmtree(directory)
+
+if __name__ == '__main__':
+    test_journal()
@@ -0,0 +1,61 @@
+from basic_client import Client
+from server_wrap import start_server_with_params
+import multiprocessing, socket, struct
+
+EVENTS_FILE = 'event_files/events_example'
+FLOODERS = 3
+ROUNDS = 20
+# the server may drop a datagram when its socket buffer is full, so a request is repeated a few times
+ATTEMPTS = 5
+
+def flood(stop):
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    request = struct.pack('!B', 1)
+    while not stop.is_set():
+        for _ in range(1000):
+            s.sendto(request, ('localhost', 2022))
+
+def request_with_retry(client, message, expected_type):
+    for _ in range(ATTEMPTS):
+        client.send_message(message)
+        reply = client.receive_message_or_none()
+        while reply is not None and reply[0] != expected_type:
+            reply = client.receive_message_or_none()
+        if reply is not None:
+            return reply
+    assert False, 'no reply to message ' + str(message[0])
+
+def test_priority_under_flood(client):
+    for _ in range(ROUNDS):
+        reply = request_with_retry(client, struct.pack('!BIH', 3, 0, 1), 4)
+        reservation_id, event_id, ticket_count, cookie, _ = struct.unpack('!IIH48sQ', reply[1:])
+        assert event_id == 0 and ticket_count == 1
+
+        reply = request_with_retry(client, struct.pack('!BI48s', 5, reservation_id, cookie), 6)
+        assert struct.unpack('!IH', reply[1:7]) == (reservation_id, 1)
+
+def test_priority():
+    server = start_server_with_params(['-f', EVENTS_FILE, '-b', '16'])
+    client = Client()
+
+    stop = multiprocessing.Event()
+    flooders = [multiprocessing.Process(target=flood, args=(stop,)) for _ in range(FLOODERS)]
+    for flooder in flooders:
+        flooder.start()
+
+    try:
+        test_priority_under_flood(client)
+    finally:
+        stop.set()
+        for flooder in flooders:
+            flooder.join()
+
+    # with the flood over, event listings are answered again
+    assert len(client.parse_events(request_with_retry(client, struct.pack('!B', 1), 2))) == 3
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_priority()
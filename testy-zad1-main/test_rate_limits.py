@@ -0,0 +1,76 @@
+from basic_client import Client
+from server_wrap import start_server_with_params, get_return_code_of_server_with_params
+import struct, time
+
+EVENTS_FILE = 'event_files/events_example'
+REFILL_TIME = 1.1
+
+def receive_all(client):
+    replies = []
+    while True:
+        data = client.receive_message_or_none()
+        if data is None:
+            return replies
+        replies.append(data)
+
+def test_bursts(client):
+    for _ in range(3):
+        client.send_message(struct.pack('!B', 1))
+        client.send_message(struct.pack('!BIH', 3, 0, 1))
+
+    replies = receive_all(client)
+    assert sorted(data[0] for data in replies) == [2, 2, 4, 4]
+
+    time.sleep(REFILL_TIME)
+    reservation_id, _, _, cookie = struct.unpack('!IIH48s', [data for data in replies if data[0] == 4][0][1:59])
+    for _ in range(3):
+        client.send_message(struct.pack('!BI48s', 5, reservation_id, cookie))
+
+    assert [data[0] for data in receive_all(client)] == [6, 6]
+
+def test_other_address(client):
+    for _ in range(3):
+        client.send_message(struct.pack('!B', 1))
+
+    other_client = Client()
+    other_client.socket.bind(('127.0.0.2', 0))
+    assert len(other_client.get_events()) == 3
+
+    assert len(receive_all(client)) == 2
+
+def test_malformed_requests(client):
+    client.send_message(b'\x01\x00')
+    client.send_message(b'\x01\x00')
+    client.send_message(struct.pack('!B', 1))
+    assert client.receive_message_or_none() is None
+
+    time.sleep(REFILL_TIME)
+    assert len(client.get_events()) == 3
+
+def test_rate_limits():
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-l', '1,2']) == 1
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-l', '1,2,1000001']) == 1
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-l', '1,x,2']) == 1
+
+    server = start_server_with_params(['-f', EVENTS_FILE, '-l', '2,2,2'])
+    client = Client()
+
+    test_bursts(client)
+    time.sleep(REFILL_TIME)
+    test_other_address(client)
+    time.sleep(REFILL_TIME)
+    test_malformed_requests(client)
+
+    server.terminate()
+    server.communicate()
+
+    server = start_server_with_params(['-f', EVENTS_FILE, '-l', '0,0,0'])
+    for _ in range(10):
+        client.send_message(struct.pack('!B', 1))
+    assert len(receive_all(client)) == 10
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_rate_limits()
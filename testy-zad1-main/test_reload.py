@@ -0,0 +1,60 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server
+import os, signal, tempfile, time
+
+def write_events(filename, ticket_counts):
+    with open(filename, 'w') as events_file:
+        for i, ticket_count in enumerate(ticket_counts):
+            events_file.write('wydarzenie ' + str(i) + '\n' + str(ticket_count) + '\n')
+
+def reload(server, filename, ticket_counts):
+    write_events(filename, ticket_counts)
+    server.send_signal(signal.SIGHUP)
+    time.sleep(1.5)
+
+def ticket_counts(client):
+    return [e.ticket_count for e in client.get_events()]
+
+def test_shrink_below_reserved(client, server, filename):
+    client.get_reservation(0, 8)
+    assert ticket_counts(client)[0] == 2
+
+    reload(server, filename, [5, 10])
+    assert ticket_counts(client)[0] == 0
+    try:
+        client.get_reservation(0, 1)
+        assert False
+    except Response255Exception:
+        pass
+
+    time.sleep(4)
+    assert ticket_counts(client)[0] == 5
+
+def test_shrink_with_collected(client, server, filename):
+    r = client.get_reservation(1, 6)
+    client.get_tickets(r.reservation_id, r.cookie)
+    client.get_reservation(1, 3)
+
+    reload(server, filename, [5, 7])
+    assert ticket_counts(client)[1] == 0
+
+    time.sleep(4)
+    assert ticket_counts(client)[1] == 1
+
+    reload(server, filename, [5, 9])
+    assert ticket_counts(client)[1] == 3
+
+def test_reload():
+    events_file, filename = tempfile.mkstemp()
+    os.close(events_file)
+    write_events(filename, [10, 10])
+    server = start_server(filename, timeout=4)
+    client = Client()
+
+    try:
+        test_shrink_below_reserved(client, server, filename)
+        test_shrink_with_collected(client, server, filename)
+    finally:
+        os.remove(filename)
+
+    server.terminate()
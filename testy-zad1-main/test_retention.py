@@ -0,0 +1,48 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params, get_return_code_of_server_with_params
+import time
+
+EVENTS_FILE = 'event_files/events_example'
+RETENTION = 2
+
+def assert_collectable(client, r, tickets):
+    assert client.get_tickets(r.reservation_id, r.cookie).tickets == tickets
+    for ticket in tickets:
+        status = client.validate_ticket(ticket)
+        assert (status.valid, status.reservation_id) == (1, r.reservation_id)
+
+def assert_retired(client, r, tickets):
+    try:
+        client.get_tickets(r.reservation_id, r.cookie)
+        assert False
+    except Response255Exception:
+        pass
+    for ticket in tickets:
+        assert client.validate_ticket(ticket).valid == 0
+
+def test_retention():
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-r', '0']) == 1
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-r', '31536001']) == 1
+
+    server = start_server_with_params(['-f', EVENTS_FILE, '-r', str(RETENTION), '-t', '30'])
+    client = Client()
+
+    collected = client.get_reservation(0, 2)
+    tickets = client.get_tickets(collected.reservation_id, collected.cookie).tickets
+    pending = client.get_reservation(1, 3)
+
+    time.sleep(RETENTION - 1)
+    assert_collectable(client, collected, tickets)
+
+    time.sleep(2.5)
+    assert_retired(client, collected, tickets)
+    assert [e.ticket_count for e in client.get_events()] == [121, 29, 0]
+
+    # retention only applies to collected reservations
+    assert client.get_tickets(pending.reservation_id, pending.cookie).ticket_count == 3
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_retention()
@@ -0,0 +1,107 @@
+from basic_client import Client
+from server_wrap import start_server_with_params, get_return_code_of_server_with_params
+import os, shutil, signal, struct, tempfile
+
+# magic, version, event_count, reservation_count, ticket_counter,
+# reservation_counter, first_reservation_id, journal_generation, parked_count
+SNAPSHOT_HEADER = '=8sIIQQIIQQ'
+
+def stop(server):
+    server.send_signal(signal.SIGTERM)
+    server.communicate()
+    assert server.returncode == 0
+
+def test_restore(snapshot):
+    params = ['-f', 'event_files/events_example', '-s', snapshot, '-t', '30']
+    server = start_server_with_params(params)
+    client = Client()
+
+    r1 = client.get_reservation(0, 3)
+    r2 = client.get_reservation(1, 4)
+    tickets = client.get_tickets(r2.reservation_id, r2.cookie).tickets
+    stop(server)
+    assert os.path.exists(snapshot)
+
+    server = start_server_with_params(params)
+    assert [e.ticket_count for e in client.get_events()] == [120, 28, 0]
+    assert [e.description for e in client.get_events()] == ['fajny koncert', 'film o kotach', 'ZOO']
+    assert client.get_tickets(r2.reservation_id, r2.cookie).tickets == tickets
+    assert client.get_tickets(r1.reservation_id, r1.cookie).ticket_count == 3
+    assert client.get_reservation(1, 1).reservation_id == r2.reservation_id + 1
+    stop(server)
+
+def kill(server):
+    server.send_signal(signal.SIGKILL)
+    server.communicate()
+
+def test_crash_after_restore(snapshot):
+    params = ['-f', 'event_files/events_example', '-s', snapshot]
+    server = start_server_with_params(params)
+    client = Client()
+
+    r1 = client.get_reservation(1, 2)
+    stop(server)
+
+    server = start_server_with_params(params)
+    assert not os.path.exists(snapshot)
+    r2 = client.get_reservation(1, 2)
+    assert r2.reservation_id == r1.reservation_id + 1
+    client.get_tickets(r2.reservation_id, r2.cookie)
+    kill(server)
+
+    assert get_return_code_of_server_with_params(params) == 1
+    assert not os.path.exists(snapshot)
+
+    os.remove(snapshot + '.consumed')
+    server = start_server_with_params(params)
+    stop(server)
+    assert os.path.exists(snapshot)
+    assert not os.path.exists(snapshot + '.consumed')
+
+def corrupted_copy(snapshot, directory, corrupt):
+    with open(snapshot, 'rb') as snapshot_file:
+        data = bytearray(snapshot_file.read())
+    corrupt(data)
+    filename = os.path.join(directory, 'corrupted')
+    with open(filename, 'wb') as corrupted_file:
+        corrupted_file.write(data)
+    return filename
+
+def test_rejects_corrupted(snapshot, directory):
+    def set_header_field(index, value):
+        def corrupt(data):
+            header = list(struct.unpack_from(SNAPSHOT_HEADER, data))
+            header[index] = value(header)
+            struct.pack_into(SNAPSHOT_HEADER, data, 0, *header)
+        return corrupt
+
+    def truncate(data):
+        del data[-1]
+
+    corruptions = [
+        set_header_field(0, lambda header: b'TKTSNAX\0'),
+        set_header_field(1, lambda header: header[1] + 1),
+        set_header_field(5, lambda header: header[6]),
+        set_header_field(6, lambda header: 5),
+        set_header_field(4, lambda header: 0),
+        truncate,
+    ]
+
+    for corrupt in corruptions:
+        filename = corrupted_copy(snapshot, directory, corrupt)
+        params = ['-f', 'event_files/events_example', '-s', filename]
+        assert get_return_code_of_server_with_params(params) == 1
+
+def test_snapshot():
+    directory = tempfile.mkdtemp()
+    snapshot = os.path.join(directory, 'snapshot')
+
+    try:
+        test_restore(snapshot)
+        test_crash_after_restore(os.path.join(directory, 'crashed'))
+        test_rejects_corrupted(snapshot, directory)
+    finally:
+        shutil.rmtree(directory)
+
+if __name__ == '__main__':
+    test_snapshot()
@@ -0,0 +1,111 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params, is_port_in_use, EXECUTABLE, DEFAULT_PORT
+import os, re, select, subprocess, time
+
+EVENTS_FILE = 'event_files/events_example'
+ADMIN_PORT = 2122
+REPORT_PATTERN = re.compile(r'stats worker=.*?\n  BAD_REQUEST[^\n]*\n', re.S)
+
+def parse_report(report):
+    lines = report.splitlines()
+    assert lines[0].startswith('stats worker=')
+
+    parsed = {'header': dict(re.findall(r'(\w+)=(\d+)', lines[0]))}
+    for line in lines[1:]:
+        name, fields = line.strip().split(' ', 1)
+        parsed[name] = dict((key, float(value)) for key, value in re.findall(r'(\w+)=([\d.]+)', fields))
+    return parsed
+
+def expect_bad_request(action):
+    try:
+        action()
+        assert False
+    except Response255Exception:
+        pass
+
+def test_admin_report(client):
+    client.get_events()
+    client.get_events()
+    r = client.get_reservation(0, 2)
+    client.get_tickets(r.reservation_id, r.cookie)
+    expect_bad_request(lambda: client.get_reservation(7, 1))
+    expect_bad_request(lambda: client.get_reservation(0, 0))
+    expect_bad_request(lambda: client.get_tickets(r.reservation_id + 1, r.cookie))
+    expect_bad_request(lambda: client.get_tickets(r.reservation_id, 'x' * 48))
+    client.send_message(b'\x01\x00')
+    assert client.receive_message_or_none() is None
+
+    report = parse_report(client.get_stats_report(ADMIN_PORT))
+    assert report['header']['worker'] == '0'
+    assert report['header']['reservations'] == '1'
+    assert report['header']['expired'] == '0'
+
+    assert report['GET_EVENTS']['requests'] == 2
+    assert report['GET_RESERVATION']['requests'] == 3
+    assert report['GET_TICKETS']['requests'] == 3
+    assert report['VALIDATE_TICKET']['requests'] == 0
+    assert report['malformed']['requests'] == 1
+    assert report['rate_limited']['requests'] == 0
+
+    latency = report['GET_RESERVATION']
+    assert 0 < latency['p50_us'] <= latency['p99_us'] <= latency['p999_us']
+    assert 'p50_us' not in report['VALIDATE_TICKET']
+
+    assert report['BAD_REQUEST'] == {
+        'unknown_event': 1,
+        'invalid_ticket_count': 1,
+        'insufficient_tickets': 0,
+        'unknown_reservation': 1,
+        'bad_cookie': 1,
+        'expired': 0,
+        'client_limit': 0,
+    }
+
+# the server prints a report every interval, which is only visible on its standard output
+def test_interval_report():
+    server = subprocess.Popen([EXECUTABLE, '-f', EVENTS_FILE, '-i', '1'], stdout=subprocess.PIPE,
+                              stderr=subprocess.DEVNULL)
+    while not is_port_in_use(DEFAULT_PORT):
+        assert server.poll() is None
+        time.sleep(0.01)
+
+    client = Client()
+    client.get_events()
+
+    deadline = time.time() + 5
+    output = ''
+    reports = []
+    while time.time() < deadline:
+        ready, _, _ = select.select([server.stdout], [], [], deadline - time.time())
+        if not ready:
+            break
+
+        chunk = os.read(server.stdout.fileno(), 1 << 16)
+        if not chunk:
+            break
+
+        output += chunk.decode('utf-8')
+        reports = [parse_report(report) for report in REPORT_PATTERN.findall(output)]
+        if any(report['GET_EVENTS']['requests'] == 1 for report in reports):
+            break
+
+    server.terminate()
+    server.communicate()
+
+    counted = [report for report in reports if report['GET_EVENTS']['requests'] == 1]
+    assert counted
+    assert counted[0]['BAD_REQUEST']['unknown_event'] == 0
+
+def test_stats():
+    server = start_server_with_params(['-f', EVENTS_FILE, '-a', str(ADMIN_PORT)])
+    client = Client()
+
+    test_admin_report(client)
+
+    server.terminate()
+    server.communicate()
+
+    test_interval_report()
+
+if __name__ == '__main__':
+    test_stats()
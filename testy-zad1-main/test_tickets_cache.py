@@ -0,0 +1,62 @@
+from basic_client import Client
+from server_wrap import start_server_with_params
+import re
+
+EVENTS_FILE = 'event_files/events_example'
+ADMIN_PORT = 2122
+# a TICKETS message with 3 tickets takes 28 bytes, so the cache holds at most 3 of them
+CACHE_SIZE = 100
+
+def stop(server):
+    server.terminate()
+    server.communicate()
+
+def get_cache_counts(client):
+    report = client.get_stats_report(ADMIN_PORT)
+    match = re.search(r'tickets_cache hits=(\d+) misses=(\d+)', report)
+    assert match is not None
+    return int(match.group(1)), int(match.group(2))
+
+def collect(client):
+    r = client.get_reservation(0, 3)
+    r.tickets = client.get_tickets(r.reservation_id, r.cookie).tickets
+    return r
+
+def get_tickets(client, r):
+    return client.get_tickets(r.reservation_id, r.cookie).tickets
+
+def test_repeated_tickets(client):
+    a = collect(client)
+    assert get_tickets(client, a) == a.tickets
+    assert get_cache_counts(client) == (1, 1)
+
+    others = [collect(client) for _ in range(5)]
+    assert get_tickets(client, a) == a.tickets
+    for r in others:
+        assert get_tickets(client, r) == r.tickets
+
+def test_recency(client):
+    a, b, c = collect(client), collect(client), collect(client)
+    assert get_tickets(client, a) == a.tickets
+    collect(client)
+    assert get_tickets(client, a) == a.tickets
+    assert get_cache_counts(client) == (2, 4)
+
+def test_tickets_cache():
+    params = ['-f', EVENTS_FILE, '-c', str(CACHE_SIZE), '-a', str(ADMIN_PORT)]
+    client = Client()
+
+    server = start_server_with_params(params)
+    test_repeated_tickets(client)
+    stop(server)
+
+    server = start_server_with_params(params)
+    test_recency(client)
+    stop(server)
+
+    server = start_server_with_params(['-f', EVENTS_FILE, '-a', str(ADMIN_PORT)])
+    assert 'tickets_cache' not in client.get_stats_report(ADMIN_PORT)
+    stop(server)
+
+if __name__ == '__main__':
+    test_tickets_cache()
@@ -0,0 +1,56 @@
+from basic_client import Client
+from server_wrap import start_server_with_params
+import struct, time
+
+EVENTS_FILE = 'event_files/events_example'
+RETENTION = 1
+
+def stop(server):
+    server.terminate()
+    server.communicate()
+
+def assert_invalid(client, ticket):
+    status = client.validate_ticket(ticket)
+    assert status.ticket == ticket
+    assert (status.valid, status.reservation_id, status.event_id) == (0, 0, 0)
+
+def test_issued_tickets(client):
+    reservations = [client.get_reservation(event_id, count) for event_id, count in [(0, 3), (1, 2), (0, 1)]]
+    for r in reservations:
+        tickets = client.get_tickets(r.reservation_id, r.cookie).tickets
+        for ticket in tickets:
+            status = client.validate_ticket(ticket)
+            assert status.ticket == ticket
+            assert (status.valid, status.reservation_id, status.event_id) == (1, r.reservation_id, r.event_id)
+    return tickets
+
+def test_invalid_tickets(client):
+    assert_invalid(client, 'ZZZZZZZ')
+    assert_invalid(client, 'abcdefg')
+    assert_invalid(client, 'AB-CDEF')
+
+    client.send_message(struct.pack('!B6s', 10, b'AAAAAA'))
+    client.send_message(struct.pack('!B8s', 10, b'AAAAAAAA'))
+    assert client.receive_message_or_none() is None
+
+def test_validate_ticket():
+    client = Client()
+
+    server = start_server_with_params(['-f', EVENTS_FILE])
+    test_issued_tickets(client)
+    test_invalid_tickets(client)
+    stop(server)
+
+    server = start_server_with_params(['-f', EVENTS_FILE, '-w', '2'])
+    test_issued_tickets(client)
+    stop(server)
+
+    server = start_server_with_params(['-f', EVENTS_FILE, '-r', str(RETENTION)])
+    tickets = test_issued_tickets(client)
+    time.sleep(RETENTION + 1)
+    client.get_events()
+    assert_invalid(client, tickets[0])
+    stop(server)
+
+if __name__ == '__main__':
+    test_validate_ticket()
@@ -0,0 +1,58 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+import struct
+
+WORKERS = 4
+ID_LIMIT = 999999
+
+def make_clients(count):
+    clients = []
+    for i in range(count):
+        client = Client()
+        client.socket.bind(('127.0.0.' + str(i + 1), 0))
+        clients.append(client)
+    return clients
+
+def test_shared_tickets(clients):
+    reservations = [(client, client.get_reservation(1, 2)) for client in clients]
+    assert len({(r.reservation_id - ID_LIMIT - 1) % WORKERS for _, r in reservations}) > 1
+
+    for client in clients:
+        assert client.get_events()[1].ticket_count == 0
+        try:
+            client.get_reservation(1, 1)
+            assert False
+        except Response255Exception:
+            pass
+
+    tickets = []
+    for client, r in reservations:
+        tickets += client.get_tickets(r.reservation_id, r.cookie).tickets
+        assert client.get_tickets(r.reservation_id, r.cookie).tickets == tickets[-2:]
+        try:
+            client.get_tickets(r.reservation_id, 'x' * 48)
+            assert False
+        except Response255Exception:
+            pass
+    assert len(set(tickets)) == 32
+
+def test_sharded_malformed(clients):
+    client = clients[0]
+    client.send_message(struct.pack('!BH', 5, 1))
+    client.send_message(b'\x05')
+    client.send_message(struct.pack('!BIH', 3, 0, 1) + b'\x00')
+    assert client.receive_message_or_none() is None
+    assert len(client.get_events()) == 3
+
+def test_workers():
+    server = start_server_with_params(['-f', 'event_files/events_example', '-w', str(WORKERS)])
+    clients = make_clients(16)
+
+    test_shared_tickets(clients)
+    test_sharded_malformed(clients)
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_workers()
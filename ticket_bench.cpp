@@ -0,0 +1,599 @@
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <array>
+#include <string>
+#include <random>
+#include <thread>
+#include <memory>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+#include "ticket_protocol.h"
+#include "latency_histogram.h"
+
+constexpr const char* USAGE_ERROR_MESSAGE =
+        "Usage: [-a <server_address>] [-p <port>] [-d <duration>] [-r <rate>] [-c <clients>] [-j <threads>]"
+        " [-m <events>,<reservations>,<tickets>] [-n <tickets_per_reservation>]\n";
+
+const uint16_t MIN_PORT = 1;
+const uint16_t MAX_PORT = 65535;
+const uint16_t DEFAULT_PORT = 2022;
+
+const uint32_t MIN_DURATION = 1;
+const uint32_t MAX_DURATION = 86400;
+const uint32_t DEFAULT_DURATION = 10;
+
+const uint32_t MIN_RATE = 1;
+const uint32_t MAX_RATE = 100000000;
+const uint32_t DEFAULT_RATE = 10000;
+
+const uint32_t MIN_CLIENTS = 1;
+const uint32_t MAX_CLIENTS = 65536;
+const uint32_t DEFAULT_CLIENTS = 64;
+
+const uint32_t MIN_THREADS = 1;
+const uint32_t MAX_THREADS = 256;
+const uint32_t DEFAULT_THREADS = 1;
+
+const uint32_t MIN_TICKETS_PER_RESERVATION = 1;
+const uint32_t MAX_TICKETS_PER_RESERVATION = (UDP_DATAGRAM_MAX_SIZE - 7) / TICKET_LENGTH;
+const uint32_t DEFAULT_TICKETS_PER_RESERVATION = 1;
+
+const uint64_t NANOSECONDS_IN_SECOND = 1000000000;
+const uint64_t RESPONSE_TIMEOUT_NS = NANOSECONDS_IN_SECOND;
+const uint64_t TIMEOUT_SCAN_INTERVAL_NS = 10000000;
+const std::size_t RESERVATION_POOL_SIZE = 4096;
+
+enum RequestType : uint8_t {
+    EVENTS_REQUEST = 0,
+    RESERVATION_REQUEST = 1,
+    TICKETS_REQUEST = 2,
+    REQUEST_TYPES = 3
+};
+
+constexpr const char* REQUEST_NAMES[REQUEST_TYPES] = {"GET_EVENTS", "GET_RESERVATION", "GET_TICKETS"};
+
+struct BenchArgs {
+    std::string server_address = "127.0.0.1";
+    uint16_t port = DEFAULT_PORT;
+    uint32_t duration = DEFAULT_DURATION;
+    uint32_t rate = DEFAULT_RATE;
+    uint32_t clients = DEFAULT_CLIENTS;
+    uint32_t threads = DEFAULT_THREADS;
+    std::array<uint32_t, REQUEST_TYPES> mix = {1, 1, 1};
+    uint16_t tickets_per_reservation = DEFAULT_TICKETS_PER_RESERVATION;
+};
+
+uint64_t monotonic_time_ns() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NANOSECONDS_IN_SECOND + now.tv_nsec;
+}
+
+struct TypeStats {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t bad_requests = 0;
+    uint64_t lost = 0;
+    LatencyHistogram latency;
+
+    void merge(const TypeStats& other) {
+        sent += other.sent;
+        received += other.received;
+        bad_requests += other.bad_requests;
+        lost += other.lost;
+        latency.merge(other.latency);
+    }
+};
+
+struct Client {
+    int socket_fd = -1;
+    bool waiting = false;
+    RequestType request_type = EVENTS_REQUEST;
+    uint32_t request_id = 0;
+    uint64_t scheduled_time = 0;
+};
+
+int connect_socket(const BenchArgs& args, bool non_blocking) {
+    int socket_fd = socket(AF_INET, SOCK_DGRAM | (non_blocking ? SOCK_NONBLOCK : 0), 0);
+
+    if (socket_fd < 0) {
+        std::cerr << "Could not open socket\n";
+        exit(1);
+    }
+
+    sockaddr_in server_address{};
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(args.port);
+
+    if (inet_pton(AF_INET, args.server_address.c_str(), &server_address.sin_addr) != 1) {
+        std::cerr << "Error: server_address is not a valid IPv4 address\n";
+        exit(1);
+    }
+
+    if (connect(socket_fd, (sockaddr*) &server_address, sizeof(server_address)) == -1) {
+        std::cerr << "Could not connect socket\n";
+        exit(1);
+    }
+
+    return socket_fd;
+}
+
+/*
+ *  Asks the server for the list of events, which is later used to pick events for GET_RESERVATION.
+ */
+std::vector<uint32_t> get_event_ids(const BenchArgs& args) {
+    int socket_fd = connect_socket(args, false);
+    timeval timeout{1, 0};
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    uint8_t request = MessageID::GET_EVENTS;
+    std::vector<char> reply(UDP_DATAGRAM_MAX_SIZE);
+    send(socket_fd, &request, sizeof(request), 0);
+    ssize_t length = recv(socket_fd, reply.data(), reply.size(), 0);
+    close(socket_fd);
+
+    if (length < 1 || uint8_t (reply[0]) != MessageID::EVENTS) {
+        std::cerr << "Server did not answer GET_EVENTS\n";
+        exit(1);
+    }
+
+    std::vector<uint32_t> event_ids;
+    ssize_t position = 1;
+
+    while (position + 7 <= length) {
+        uint32_t event_id;
+        memcpy(&event_id, reply.data() + position, sizeof(event_id));
+        event_ids.push_back(ntohl(event_id));
+        position += 7 + uint8_t (reply[position + 6]);
+    }
+
+    if (event_ids.empty()) {
+        std::cerr << "Server has no events\n";
+        exit(1);
+    }
+
+    return event_ids;
+}
+
+/*
+ *  Every load worker sends requests on its own client sockets on a fixed schedule, independent of how fast
+ *  the server replies (open loop). A client socket has at most one outstanding request, which allows replies
+ *  to be matched with requests. If all sockets are waiting when a request is due, the request is skipped and
+ *  counted, so that a saturated server shows up instead of silently lowering the offered load.
+ *
+ *  Latency is measured from the time the request was scheduled, not from when it was actually sent, so that
+ *  requests delayed by a stalled worker count the delay (no coordinated omission). A reply is accepted only if
+ *  its type and echoed event or reservation id match the outstanding request, and a socket whose request
+ *  timed out is replaced, so that a late reply is never taken as the answer to a newer request.
+ */
+class LoadWorker {
+private:
+    const BenchArgs& args;
+    const std::vector<uint32_t>& event_ids;
+    uint64_t interval_ns;
+    std::vector<Client> clients;
+    std::vector<pollfd> descriptors;
+    std::vector<GetTicketsMessage> reservations;
+    std::size_t next_reservation = 0;
+    std::size_t next_client = 0;
+    std::mt19937 generator;
+    std::discrete_distribution<int> mix_distribution;
+    std::vector<char> reply;
+    std::array<TypeStats, REQUEST_TYPES> stats;
+    uint64_t skipped = 0;
+
+    Client* find_idle_client() {
+        for (std::size_t i = 0; i < clients.size(); i++) {
+            Client& client = clients[next_client];
+            next_client = (next_client + 1) % clients.size();
+            if (!client.waiting) return &client;
+        }
+
+        return nullptr;
+    }
+
+    void send_request(Client& client, uint64_t scheduled_time) {
+        auto request_type = RequestType (mix_distribution(generator));
+        if (request_type == TICKETS_REQUEST && reservations.empty()) request_type = RESERVATION_REQUEST;
+
+        char request[sizeof(ReceivedMessage)];
+        std::size_t length = 1;
+        uint32_t request_id = 0;
+
+        switch (request_type) {
+            case EVENTS_REQUEST: {
+                request[0] = char (MessageID::GET_EVENTS);
+                break;
+            }
+            case RESERVATION_REQUEST: {
+                GetReservationMessage message{};
+                message.event_id = htonl(event_ids[generator() % event_ids.size()]);
+                message.ticket_count = htons(args.tickets_per_reservation);
+                request_id = message.event_id;
+                request[0] = char (MessageID::GET_RESERVATION);
+                memcpy(request + 1, &message, sizeof(message));
+                length += sizeof(message);
+                break;
+            }
+            default: {
+                const GetTicketsMessage& message = reservations[generator() % reservations.size()];
+                request[0] = char (MessageID::GET_TICKETS);
+                memcpy(request + 1, &message, sizeof(message));
+                length += sizeof(message);
+                request_id = message.reservation_id;
+                break;
+            }
+        }
+
+        if (send(client.socket_fd, request, length, 0) != (ssize_t) length) {
+            stats[request_type].lost += 1;
+            return;
+        }
+
+        client.waiting = true;
+        client.request_type = request_type;
+        client.request_id = request_id;
+        client.scheduled_time = scheduled_time;
+        stats[request_type].sent += 1;
+    }
+
+    void store_reservation(ssize_t length) {
+        if (length != (ssize_t) sizeof(ReservationMessage)) return;
+
+        auto reservation_msg = (const ReservationMessage*) reply.data();
+        GetTicketsMessage tickets_msg{};
+        tickets_msg.reservation_id = reservation_msg->reservation_id;
+        memcpy(tickets_msg.cookie, reservation_msg->cookie, COOKIE_LENGTH);
+
+        if (reservations.size() < RESERVATION_POOL_SIZE) {
+            reservations.push_back(tickets_msg);
+        }
+        else {
+            reservations[next_reservation] = tickets_msg;
+            next_reservation = (next_reservation + 1) % RESERVATION_POOL_SIZE;
+        }
+    }
+
+    /*
+     *  Checks that a reply answers the outstanding request of the client. Replies carry no sequence number, but
+     *  RESERVATION echoes the event id, TICKETS the reservation id and BAD_REQUEST whichever of them was sent.
+     */
+    [[nodiscard]] bool is_matching_reply(const Client& client, ssize_t length) const {
+        uint32_t id;
+
+        switch (uint8_t (reply[0])) {
+            case MessageID::EVENTS: {
+                return client.request_type == EVENTS_REQUEST;
+            }
+            case MessageID::RESERVATION: {
+                if (client.request_type != RESERVATION_REQUEST || length != (ssize_t) sizeof(ReservationMessage)) {
+                    return false;
+                }
+                memcpy(&id, reply.data() + offsetof(ReservationMessage, event_id), sizeof(id));
+                return id == client.request_id;
+            }
+            case MessageID::TICKETS: {
+                if (client.request_type != TICKETS_REQUEST || length < (ssize_t) sizeof(TicketsMessage)) {
+                    return false;
+                }
+                memcpy(&id, reply.data() + offsetof(TicketsMessage, reservation_id), sizeof(id));
+                return id == client.request_id;
+            }
+            case MessageID::BAD_REQUEST: {
+                if (client.request_type == EVENTS_REQUEST || length != (ssize_t) sizeof(BadRequestMessage)) {
+                    return false;
+                }
+                memcpy(&id, reply.data() + offsetof(BadRequestMessage, id), sizeof(id));
+                return id == client.request_id;
+            }
+            default: {
+                return false;
+            }
+        }
+    }
+
+    void receive_replies(Client& client) {
+        while (true) {
+            ssize_t length = recv(client.socket_fd, reply.data(), reply.size(), 0);
+            if (length <= 0) return;
+            if (!client.waiting || !is_matching_reply(client, length)) continue;
+
+            TypeStats& type_stats = stats[client.request_type];
+            type_stats.received += 1;
+            type_stats.latency.record(monotonic_time_ns() - client.scheduled_time);
+            client.waiting = false;
+
+            if (uint8_t (reply[0]) == MessageID::BAD_REQUEST) {
+                type_stats.bad_requests += 1;
+            }
+            else if (uint8_t (reply[0]) == MessageID::RESERVATION) {
+                store_reservation(length);
+            }
+        }
+    }
+
+    void expire_requests(uint64_t now) {
+        for (std::size_t i = 0; i < clients.size(); i++) {
+            Client& client = clients[i];
+            if (!client.waiting || now - client.scheduled_time <= RESPONSE_TIMEOUT_NS) continue;
+
+            stats[client.request_type].lost += 1;
+            client.waiting = false;
+
+            // GET_EVENTS replies cannot be told apart, so a late one must not reach the next request.
+            close(client.socket_fd);
+            client.socket_fd = connect_socket(args, true);
+            descriptors[i].fd = client.socket_fd;
+        }
+    }
+
+    void poll_clients(uint64_t wait_ns) {
+        timespec timeout{};
+        timeout.tv_sec = wait_ns / NANOSECONDS_IN_SECOND;
+        timeout.tv_nsec = wait_ns % NANOSECONDS_IN_SECOND;
+
+        if (ppoll(descriptors.data(), descriptors.size(), &timeout, nullptr) <= 0) return;
+
+        for (std::size_t i = 0; i < descriptors.size(); i++) {
+            if (descriptors[i].revents & POLLIN) receive_replies(clients[i]);
+        }
+    }
+
+public:
+    LoadWorker(const BenchArgs& args, const std::vector<uint32_t>& event_ids, uint32_t clients_count,
+               uint32_t rate, uint32_t seed) :
+            args(args), event_ids(event_ids), clients(clients_count), descriptors(clients_count),
+            generator(seed), mix_distribution(args.mix.begin(), args.mix.end()), reply(UDP_DATAGRAM_MAX_SIZE) {
+        interval_ns = NANOSECONDS_IN_SECOND / rate;
+
+        for (uint32_t i = 0; i < clients_count; i++) {
+            clients[i].socket_fd = connect_socket(args, true);
+            descriptors[i].fd = clients[i].socket_fd;
+            descriptors[i].events = POLLIN;
+        }
+    }
+
+    ~LoadWorker() {
+        for (auto& client: clients) {
+            close(client.socket_fd);
+        }
+    }
+
+    [[nodiscard]] const std::array<TypeStats, REQUEST_TYPES>& get_stats() const {
+        return stats;
+    }
+
+    [[nodiscard]] uint64_t get_skipped() const {
+        return skipped;
+    }
+
+    void run(uint64_t start_time, uint64_t end_time) {
+        uint64_t next_send = start_time;
+        uint64_t next_timeout_scan = start_time + TIMEOUT_SCAN_INTERVAL_NS;
+
+        while (true) {
+            uint64_t now = monotonic_time_ns();
+
+            while (next_send <= now && next_send < end_time) {
+                Client* client = find_idle_client();
+
+                if (client != nullptr) {
+                    send_request(*client, next_send);
+                }
+                else {
+                    skipped += 1;
+                }
+
+                next_send += interval_ns;
+            }
+
+            if (now >= next_timeout_scan) {
+                expire_requests(now);
+                next_timeout_scan = now + TIMEOUT_SCAN_INTERVAL_NS;
+            }
+
+            if (now >= end_time + RESPONSE_TIMEOUT_NS) break;
+
+            uint64_t wake_time = next_send < end_time ? next_send : next_timeout_scan;
+            poll_clients(wake_time > now ? wake_time - now : 0);
+        }
+
+        expire_requests(UINT64_MAX);
+    }
+};
+
+unsigned long parse_numeric_argument(const char* arg, const std::string& name, uint32_t min, uint32_t max) {
+    uint64_t value;
+
+    try {
+        std::size_t position;
+        value = std::stoul(arg, &position, 10);
+
+        if (position != std::strlen(arg)) {
+            std::cerr << name << " value is not a number.\n";
+            exit(1);
+        }
+    }
+    catch (std::out_of_range& e) {
+        std::cerr << name << " value is out of range. Acceptable range: " << min << "-" << max << "\n";
+        exit(1);
+    }
+    catch (std::invalid_argument& e) {
+        std::cerr << name << " value is not a number.\n";
+        exit(1);
+    }
+
+    if (value < min || value > max) {
+        std::cerr << name << " value is out of range. Acceptable range: " << min << "-" << max << "\n";
+        exit(1);
+    }
+
+    return value;
+}
+
+std::array<uint32_t, REQUEST_TYPES> parse_mix(const char* arg) {
+    std::array<uint32_t, REQUEST_TYPES> mix{};
+    std::string weights(arg);
+    std::size_t position = 0;
+    uint32_t total = 0;
+
+    for (uint8_t i = 0; i < REQUEST_TYPES; i++) {
+        std::size_t separator = weights.find(',', position);
+
+        if ((i + 1 < REQUEST_TYPES) == (separator == std::string::npos)) {
+            std::cerr << "mix has to consist of " << int (REQUEST_TYPES) << " comma separated weights.\n";
+            exit(1);
+        }
+
+        std::string weight = weights.substr(position, separator - position);
+        mix[i] = parse_numeric_argument(weight.c_str(), "mix weight", 0, 1000000);
+        total += mix[i];
+        position = separator + 1;
+    }
+
+    if (total == 0) {
+        std::cerr << "mix has to contain a positive weight.\n";
+        exit(1);
+    }
+
+    return mix;
+}
+
+BenchArgs get_bench_args(int argc, char** argv) {
+    BenchArgs bench_args;
+    int number_of_used_flags = 0;
+    int c;
+
+    opterr = 0;
+
+    while ((c = getopt(argc, argv, "a:p:d:r:c:j:m:n:")) != -1) {
+        number_of_used_flags += 1;
+
+        switch (c) {
+            case 'a': {
+                bench_args.server_address = optarg;
+                break;
+            }
+            case 'p': {
+                bench_args.port = parse_numeric_argument(optarg, "port", MIN_PORT, MAX_PORT);
+                break;
+            }
+            case 'd': {
+                bench_args.duration = parse_numeric_argument(optarg, "duration", MIN_DURATION, MAX_DURATION);
+                break;
+            }
+            case 'r': {
+                bench_args.rate = parse_numeric_argument(optarg, "rate", MIN_RATE, MAX_RATE);
+                break;
+            }
+            case 'c': {
+                bench_args.clients = parse_numeric_argument(optarg, "clients", MIN_CLIENTS, MAX_CLIENTS);
+                break;
+            }
+            case 'j': {
+                bench_args.threads = parse_numeric_argument(optarg, "threads", MIN_THREADS, MAX_THREADS);
+                break;
+            }
+            case 'm': {
+                bench_args.mix = parse_mix(optarg);
+                break;
+            }
+            case 'n': {
+                bench_args.tickets_per_reservation = parse_numeric_argument(optarg, "tickets_per_reservation",
+                                                                            MIN_TICKETS_PER_RESERVATION,
+                                                                            MAX_TICKETS_PER_RESERVATION);
+                break;
+            }
+            default: {
+                std::cerr << USAGE_ERROR_MESSAGE;
+                exit(1);
+            }
+        }
+    }
+
+    if ((argc - 1) > (number_of_used_flags * 2)) {
+        std::cerr << USAGE_ERROR_MESSAGE;
+        exit(1);
+    }
+
+    if (bench_args.clients < bench_args.threads || bench_args.rate < bench_args.threads) {
+        std::cerr << "Error: clients and rate have to be at least equal to threads\n";
+        exit(1);
+    }
+
+    return bench_args;
+}
+
+void print_report(const BenchArgs& args, const std::array<TypeStats, REQUEST_TYPES>& stats, uint64_t skipped) {
+    std::cout << std::left << std::setw(16) << "type" << std::right
+              << std::setw(12) << "sent" << std::setw(12) << "received" << std::setw(12) << "bad_request"
+              << std::setw(10) << "lost" << std::setw(14) << "throughput/s"
+              << std::setw(11) << "p50[us]" << std::setw(11) << "p99[us]" << std::setw(11) << "p999[us]" << "\n";
+
+    for (uint8_t i = 0; i < REQUEST_TYPES; i++) {
+        const TypeStats& type_stats = stats[i];
+        bool any = type_stats.latency.get_count() > 0;
+
+        std::cout << std::left << std::setw(16) << REQUEST_NAMES[i] << std::right
+                  << std::setw(12) << type_stats.sent << std::setw(12) << type_stats.received
+                  << std::setw(12) << type_stats.bad_requests << std::setw(10) << type_stats.lost
+                  << std::setw(14) << type_stats.received / args.duration << std::fixed << std::setprecision(1)
+                  << std::setw(11) << (any ? type_stats.latency.get_percentile(50) / 1000.0 : 0.0)
+                  << std::setw(11) << (any ? type_stats.latency.get_percentile(99) / 1000.0 : 0.0)
+                  << std::setw(11) << (any ? type_stats.latency.get_percentile(99.9) / 1000.0 : 0.0) << "\n";
+    }
+
+    std::cout << "skipped (all clients busy): " << skipped << "\n";
+}
+
+int main(int argc, char** argv) {
+    BenchArgs bench_args = get_bench_args(argc, argv);
+    std::vector<uint32_t> event_ids = get_event_ids(bench_args);
+    std::vector<std::unique_ptr<LoadWorker>> workers;
+
+    for (uint32_t i = 0; i < bench_args.threads; i++) {
+        uint32_t clients = bench_args.clients / bench_args.threads + (i < bench_args.clients % bench_args.threads);
+        uint32_t rate = bench_args.rate / bench_args.threads + (i < bench_args.rate % bench_args.threads);
+        workers.push_back(std::make_unique<LoadWorker>(bench_args, event_ids, clients, rate, i + 1));
+    }
+
+    std::cout << "Sending " << bench_args.rate << " requests/s for " << bench_args.duration << " s from "
+              << bench_args.clients << " clients on " << bench_args.threads << " threads\n";
+
+    uint64_t start_time = monotonic_time_ns();
+    uint64_t end_time = start_time + bench_args.duration * NANOSECONDS_IN_SECOND;
+    std::vector<std::thread> threads;
+
+    for (auto& worker: workers) {
+        threads.emplace_back(&LoadWorker::run, worker.get(), start_time, end_time);
+    }
+
+    std::array<TypeStats, REQUEST_TYPES> stats;
+    uint64_t skipped = 0;
+
+    for (uint32_t i = 0; i < bench_args.threads; i++) {
+        threads[i].join();
+
+        for (uint8_t j = 0; j < REQUEST_TYPES; j++) {
+            stats[j].merge(workers[i]->get_stats()[j]);
+        }
+
+        skipped += workers[i]->get_skipped();
+    }
+
+    print_report(bench_args, stats, skipped);
+
+    return 0;
+}
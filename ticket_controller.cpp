@@ -0,0 +1,632 @@
+#include "ticket_controller.h"
+
+/*
+ *  Writes the given number of the least significant base-36 digits of number, least significant first.
+ */
+static void write_ticket_digits(uint64_t number, char* digits, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        uint64_t n = number / TICKET_CODE_BASE;
+        digits[i] = TICKET_DIGITS[number - (n * TICKET_CODE_BASE)];
+        number = n;
+    }
+}
+
+void generate_ticket_code(uint64_t ticket_number, char* code) {
+    write_ticket_digits(ticket_number, code, TICKET_LENGTH);
+}
+
+/*
+ *  Ticket codes hold the least significant digit first. Consecutive numbers share all higher digits within each
+ *  run of TICKET_CODE_BASE numbers, so these are computed with divisions once per run and every code is written
+ *  straight into the output as the digit of its number within the run followed by a copy of the higher digits.
+ *  No code is read back from the output, so the stores do not wait on each other.
+ */
+void generate_ticket_codes(const TicketRange& tickets, char* codes) {
+    uint64_t high_number = tickets.get_first_number() / TICKET_CODE_BASE;
+    uint32_t low_digit = tickets.get_first_number() - high_number * TICKET_CODE_BASE;
+    char high_digits[TICKET_LENGTH - 1];
+    write_ticket_digits(high_number, high_digits, TICKET_LENGTH - 1);
+
+    for (uint16_t i = 0; i < tickets.get_count(); i++) {
+        codes[0] = TICKET_DIGITS[low_digit];
+        memcpy(codes + 1, high_digits, TICKET_LENGTH - 1);
+        codes += TICKET_LENGTH;
+
+        if (++low_digit == TICKET_CODE_BASE) {
+            low_digit = 0;
+            high_number += 1;
+            write_ticket_digits(high_number, high_digits, TICKET_LENGTH - 1);
+        }
+    }
+}
+
+/*
+ *  Reverse of generate_ticket_code. Returns false if the code contains a character which is not a digit.
+ */
+bool decode_ticket_code(const char* code, uint64_t* ticket_number) {
+    uint64_t number = 0;
+
+    for (uint8_t i = TICKET_LENGTH; i > 0; i--) {
+        int8_t value = TICKET_DIGIT_VALUES[uint8_t (code[i - 1])];
+        if (value < 0) return false;
+        number = number * TICKET_CODE_BASE + value;
+    }
+
+    *ticket_number = number;
+
+    return true;
+}
+
+/*
+ *  Random word from the kernel, for values which must not repeat across restarts of the server.
+ */
+uint32_t get_random_word() {
+    uint32_t word;
+    std::size_t filled = 0;
+
+    while (filled < sizeof(word)) {
+        ssize_t ret = getrandom((char*) &word + filled, sizeof(word) - filled, 0);
+
+        if (ret < 0 && errno != EINTR) {
+            std::cerr << "Could not read random bytes\n";
+            exit(1);
+        }
+
+        if (ret > 0) filled += ret;
+    }
+
+    return word;
+}
+
+const char* get_request_name(uint8_t message_id) {
+    switch (message_id) {
+        case MessageID::GET_EVENTS: return "GET_EVENTS";
+        case MessageID::GET_RESERVATION: return "GET_RESERVATION";
+        case MessageID::GET_TICKETS: return "GET_TICKETS";
+        case MessageID::GET_EVENTS_PAGE: return "GET_EVENTS_PAGE";
+        case MessageID::GET_EVENTS_DELTA: return "GET_EVENTS_DELTA";
+        case MessageID::VALIDATE_TICKET: return "VALIDATE_TICKET";
+        default: return "other";
+    }
+}
+
+uint64_t monotonic_time_ns() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * uint64_t(1000000000) + now.tv_nsec;
+}
+
+/*
+ *  Compares two cookies in time independent of their contents, so that response times tell an attacker nothing
+ *  about how much of a guessed cookie is right. All bytes are always read, as words whose differences are
+ *  OR-ed together, and the only branch is on the result. The compiler turns the loop into vector instructions.
+ */
+bool cookies_match(const char* cookie, const char* other_cookie) {
+    static_assert(COOKIE_LENGTH % sizeof(uint64_t) == 0, "cookies are compared word by word");
+    uint64_t difference = 0;
+
+    for (uint8_t i = 0; i < COOKIE_LENGTH; i += sizeof(uint64_t)) {
+        uint64_t word;
+        uint64_t other_word;
+        memcpy(&word, cookie + i, sizeof(word));
+        memcpy(&other_word, other_cookie + i, sizeof(other_word));
+        difference |= word ^ other_word;
+    }
+
+    return difference == 0;
+}
+
+void TicketController::build_events_message() {
+    events_message.clear();
+    ticket_count_offsets.clear();
+    events_message.push_back(MessageID::EVENTS);
+
+    for (uint32_t i = 0; i < events.size(); i++) {
+        std::string_view description = events.get_description(i);
+        uint64_t event_size = 1 + 2 + 4 + description.length();
+        if (events_message.size() + event_size > UDP_DATAGRAM_MAX_SIZE) break;
+
+        uint32_t event_id = htonl(i);
+        uint16_t ticket_count = htons(events.get_ticket_count(i));
+        auto description_length = (uint8_t) description.length();
+        auto pointer_cpy = (const char*) &event_id;
+        events_message.insert(events_message.end(), pointer_cpy, pointer_cpy + 4);
+        ticket_count_offsets.push_back(events_message.size());
+        pointer_cpy = (const char*) &ticket_count;
+        events_message.insert(events_message.end(), pointer_cpy, pointer_cpy + 2);
+        events_message.push_back(char (description_length));
+        events_message.insert(events_message.end(), description.begin(), description.end());
+    }
+}
+
+void TicketController::build_event_records() {
+    event_records.clear();
+    record_offsets.clear();
+
+    for (uint32_t i = 0; i < events.size(); i++) {
+        std::string_view description = events.get_description(i);
+        uint32_t event_id = htonl(i);
+        uint16_t ticket_count = 0;
+        auto pointer_cpy = (const char*) &event_id;
+        record_offsets.push_back(event_records.size());
+        event_records.insert(event_records.end(), pointer_cpy, pointer_cpy + 4);
+        pointer_cpy = (const char*) &ticket_count;
+        event_records.insert(event_records.end(), pointer_cpy, pointer_cpy + 2);
+        event_records.push_back(char (description.length()));
+        event_records.insert(event_records.end(), description.begin(), description.end());
+    }
+
+    record_offsets.push_back(event_records.size());
+}
+
+std::vector<Event> TicketController::get_event_states() const {
+    std::vector<Event> states(events.size());
+
+    for (uint32_t i = 0; i < events.size(); i++) {
+        states[i].event_id = i;
+        states[i].description = events.get_description(i);
+        states[i].ticket_count = events.get_ticket_count(i);
+        states[i].capacity = events.get_capacity(i);
+        states[i].deficit = events.get_deficit(i);
+    }
+
+    return states;
+}
+
+void TicketController::patch_events_message(uint32_t event_id, uint16_t ticket_count) {
+    if (event_id < ticket_count_offsets.size()) {
+        uint16_t value = htons(ticket_count);
+        memcpy(events_message.data() + ticket_count_offsets[event_id], &value, sizeof(value));
+    }
+}
+
+void TicketController::refresh_events_message() {
+    uint64_t version = inventory->get_version();
+    if (version == events_version) return;
+    events_version = version;
+
+    for (uint32_t event_id = 0; event_id < ticket_count_offsets.size(); event_id++) {
+        patch_events_message(event_id, inventory->get_ticket_count(event_id));
+    }
+}
+
+bool TicketController::take_tickets(uint32_t event_id, uint16_t ticket_count) {
+    if (inventory != nullptr) return inventory->try_take(event_id, ticket_count, shard_index);
+    uint16_t available = events.get_ticket_count(event_id);
+    if (available < ticket_count) return false;
+    set_ticket_count(event_id, available - ticket_count);
+
+    return true;
+}
+
+void TicketController::return_tickets(uint32_t event_id, uint16_t ticket_count) {
+    if (inventory != nullptr) {
+        inventory->give_back(event_id, ticket_count, shard_index);
+    }
+    else {
+        uint16_t deficit = events.get_deficit(event_id);
+        uint16_t paid_off = std::min(deficit, ticket_count);
+        if (paid_off > 0) events.set_deficit(event_id, deficit - paid_off);
+        if (ticket_count > paid_off) {
+            set_ticket_count(event_id, events.get_ticket_count(event_id) + ticket_count - paid_off);
+        }
+    }
+}
+
+TicketRange TicketController::take_ticket_numbers(uint16_t ticket_count) {
+    if (ticket_counter + ticket_count > ticket_block_end) {
+        ticket_counter = 1 + next_ticket_block * TICKET_NUMBER_BLOCK;
+        ticket_block_end = ticket_counter + TICKET_NUMBER_BLOCK;
+        next_ticket_block += shard_count;
+    }
+
+    TicketRange tickets(ticket_counter, ticket_count);
+    ticket_counter += ticket_count;
+
+    return tickets;
+}
+
+Reservation& TicketController::add_reservation(Reservation reservation) {
+    reservation_counter = reservation.get_reservation_id() + shard_count;
+    reservation.set_expiry_handle(expiry_wheel.schedule(reservation.get_reservation_id(),
+                                                        reservation.get_expiration_time()));
+    client_holdings.hold(reservation.get_client_address(), reservation.get_ticket_count());
+
+    return reservations.insert(reservation);
+}
+
+void TicketController::collect_reservation(Reservation& reservation, uint64_t first_ticket_number, uint64_t time) {
+    client_holdings.release(reservation.get_client_address(), reservation.get_ticket_count());
+    expiry_wheel.cancel(reservation.get_expiry_handle());
+    reservation.set_expiry_handle(WHEEL_NO_NODE);
+    reservation.issue_tickets(first_ticket_number);
+    ticket_index.add(reservation.get_tickets(), reservation.get_reservation_id());
+
+    if (retention > 0) {
+        reservation.set_expiry_handle(expiry_wheel.schedule(reservation.get_reservation_id(), time + retention));
+    }
+}
+
+void TicketController::remove_reservation(const Reservation& reservation) {
+    bool collected = reservation.is_collected();
+
+    if (!collected) {
+        return_tickets(reservation.get_event_id(), reservation.get_ticket_count());
+        client_holdings.release(reservation.get_client_address(), reservation.get_ticket_count());
+    }
+
+    reservations.erase(reservation.get_reservation_id());
+
+    if (collected) {
+        ticket_index.trim([this](uint32_t reservation_id) {
+            return reservations.find(reservation_id) == nullptr;
+        });
+    }
+}
+
+void TicketController::replay_record(const JournalRecord& record) {
+    Reservation* reservation = reservations.find(record.reservation_id);
+
+    switch (record.type) {
+        case JOURNAL_RESERVED: {
+            if (record.reservation_id != reservation_counter || record.event_id >= events.size()) {
+                reject_journal();
+            }
+
+            uint16_t ticket_count = record.ticket_count;
+            if (ticket_count == 0 || uint64_t (TICKET_LENGTH) * ticket_count + 7 > UDP_DATAGRAM_MAX_SIZE) {
+                reject_journal();
+            }
+
+            if (!take_tickets(record.event_id, record.ticket_count)) reject_journal();
+            add_reservation(Reservation(0, record.reservation_id, record.event_id, record.ticket_count,
+                                        record.time, record.cookie, record.client_address));
+            break;
+        }
+        case JOURNAL_COLLECTED: {
+            if (reservation == nullptr || reservation->is_collected()) reject_journal();
+            collect_reservation(*reservation, record.first_ticket_number, record.time);
+            ticket_counter = std::max(ticket_counter, record.first_ticket_number + record.ticket_count);
+            break;
+        }
+        case JOURNAL_REMOVED: {
+            if (reservation == nullptr) reject_journal();
+            if (reservation->get_expiry_handle() != WHEEL_NO_NODE) {
+                expiry_wheel.cancel(reservation->get_expiry_handle());
+            }
+            remove_reservation(*reservation);
+            break;
+        }
+        default: {
+            reject_journal();
+        }
+    }
+}
+
+TicketController::TicketController(const ServerArgs& server_args, const std::vector<Event>& events,
+                                   uint32_t shard_index, uint32_t shard_count, Inventory* inventory) :
+        expiry_wheel(std::time(nullptr)), reservations(ID_LIMIT + 1 + shard_index, shard_count), events(events),
+        client_holdings(server_args.max_client_tickets) {
+    timeout = server_args.timeout;
+    retention = server_args.retention;
+    this->shard_index = shard_index;
+    this->shard_count = shard_count;
+    this->inventory = inventory;
+    reservation_counter = ID_LIMIT + 1 + shard_index;
+    next_ticket_block = shard_index;
+    if (inventory != nullptr) ticket_block_end = 0;
+    build_events_message();
+    build_event_records();
+    change_log.resize(CHANGE_LOG_SIZE);
+    counts_version = uint64_t(get_random_word()) << 32;
+    first_counts_version = counts_version;
+    delta_marks.resize(this->events.size());
+}
+
+void TicketController::remove_expired_reservations(uint64_t time) {
+    expiry_wheel.advance(time, [this, time](uint32_t reservation_id) {
+        Reservation* reservation = reservations.find(reservation_id);
+
+        if (!reservation->is_collected()) {
+            expired_count += 1;
+        }
+        else {
+            retired_count += 1;
+        }
+
+        log_change(JOURNAL_REMOVED, *reservation, time);
+        remove_reservation(*reservation);
+    });
+}
+
+std::size_t TicketController::write_events_page(EventsPageRequest request, char* buffer) const {
+    buffer[0] = char (MessageID::EVENTS);
+    std::size_t length = 1;
+    bool only_available = request.is_only_available();
+
+    for (uint32_t event_id = request.get_first_event_id(); event_id < events.size(); event_id++) {
+        uint16_t ticket_count = get_available_tickets(event_id);
+        if (only_available && ticket_count == 0) continue;
+
+        std::size_t record_length = record_offsets[event_id + 1] - record_offsets[event_id];
+        if (length + record_length > UDP_DATAGRAM_MAX_SIZE) break;
+
+        memcpy(buffer + length, event_records.data() + record_offsets[event_id], record_length);
+        ticket_count = htons(ticket_count);
+        memcpy(buffer + length + 4, &ticket_count, sizeof(ticket_count));
+        length += record_length;
+    }
+
+    return length;
+}
+
+std::size_t TicketController::write_events_delta(EventsDeltaRequest request, char* buffer) {
+    auto delta_msg = (EventsDeltaMessage*) buffer;
+    delta_msg->message_id = MessageID::EVENTS_DELTA;
+    uint32_t count = 0;
+    uint64_t client_version = request.get_version();
+
+    bool covered = inventory == nullptr && client_version <= counts_version &&
+                   counts_version - client_version <= CHANGE_LOG_SIZE &&
+                   client_version >= first_counts_version;
+
+    if (covered) {
+        delta_serial += 1;
+
+        for (uint64_t version = client_version + 1; version <= counts_version; version++) {
+            uint32_t event_id = change_log[version & (CHANGE_LOG_SIZE - 1)];
+            if (delta_marks[event_id] == delta_serial) continue;
+            delta_marks[event_id] = delta_serial;
+
+            EventCount event_count{htonl(event_id), htons(events.get_ticket_count(event_id))};
+            memcpy(&delta_msg->counts[count], &event_count, sizeof(event_count));
+            count += 1;
+        }
+    }
+    else {
+        uint32_t max_count = (UDP_DATAGRAM_MAX_SIZE - sizeof(EventsDeltaMessage)) / sizeof(EventCount);
+
+        for (; count < events.size() && count < max_count; count++) {
+            EventCount event_count{htonl(count), htons(get_available_tickets(count))};
+            memcpy(&delta_msg->counts[count], &event_count, sizeof(event_count));
+        }
+    }
+
+    if (covered) {
+        delta_msg->full = DELTA_CHANGES;
+    }
+    else {
+        delta_msg->full = count < events.size() ? DELTA_TRUNCATED : DELTA_FULL;
+    }
+    delta_msg->version = htobe64(inventory == nullptr ? counts_version : inventory->get_version());
+
+    return sizeof(EventsDeltaMessage) + count * sizeof(EventCount);
+}
+
+ReservationResult TicketController::get_reservation(ReservationRequest request, uint32_t client_address,
+                                                    uint64_t time) {
+    uint32_t event_id = request.get_event_id();
+    uint16_t ticket_count = request.get_ticket_count();
+
+    if (ticket_count == 0) return INVALID_TICKET_COUNT;
+    uint64_t cmp = TICKET_LENGTH * ticket_count + 7;
+    if (cmp > UDP_DATAGRAM_MAX_SIZE) return INVALID_TICKET_COUNT;
+
+    if (event_id >= events.size()) return UNKNOWN_EVENT;
+    if (!client_holdings.can_hold(client_address, ticket_count)) return CLIENT_LIMIT;
+    if (!take_tickets(event_id, ticket_count)) return INSUFFICIENT_TICKETS;
+
+    char cookie[COOKIE_LENGTH];
+    cookie_generator.generate_cookie(cookie);
+    Reservation& reservation = add_reservation(Reservation(timeout, reservation_counter, event_id, ticket_count,
+                                                           time, cookie, client_address));
+    log_change(JOURNAL_RESERVED, reservation, reservation.get_expiration_time());
+
+    return reservation;
+}
+
+ReservationResult TicketController::get_tickets(TicketsRequest request, uint64_t time) {
+    Reservation* reservation = reservations.find(request.get_reservation_id());
+    if (reservation == nullptr) return UNKNOWN_RESERVATION;
+
+    bool cookie_matches = cookies_match(request.get_cookie(), reservation->get_cookie());
+    bool expired = !reservation->is_collected() && reservation->get_expiration_time() <= time;
+
+    if (!cookie_matches) return BAD_COOKIE;
+    if (expired) return RESERVATION_EXPIRED;
+
+    if (!reservation->is_collected()) {
+        TicketRange tickets = take_ticket_numbers(reservation->get_ticket_count());
+        collect_reservation(*reservation, tickets.get_first_number(), time);
+        log_change(JOURNAL_COLLECTED, *reservation, time);
+    }
+
+    return *reservation;
+}
+
+const Reservation* TicketController::validate_ticket(TicketValidationRequest request) {
+    uint64_t ticket_number;
+    if (!decode_ticket_code(request.get_ticket(), &ticket_number)) return nullptr;
+
+    uint32_t reservation_id = ticket_index.find(ticket_number);
+    if (reservation_id == 0) return nullptr;
+
+    const Reservation* reservation = reservations.find(reservation_id);
+    if (reservation == nullptr || !reservation->get_tickets().contains(ticket_number)) return nullptr;
+
+    return reservation;
+}
+
+void TicketController::open_journal(Journal& journal_writer, const std::string& journal_path, uint64_t generation) {
+    uint64_t valid_length = 0;
+
+    if (access(journal_path.c_str(), F_OK) == 0) {
+        MappedFile journal_file(journal_path, "journal");
+        JournalHeader header{};
+
+        if (journal_file.get_size() >= sizeof(header)) {
+            memcpy(&header, journal_file.get_data(), sizeof(header));
+
+            if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0) reject_journal();
+            if (header.version != JOURNAL_VERSION || header.generation > generation) reject_journal();
+        }
+
+        if (journal_file.get_size() >= sizeof(header) && header.generation == generation) {
+            uint64_t record_count = (journal_file.get_size() - sizeof(header)) / sizeof(JournalRecord);
+
+            for (uint64_t i = 0; i < record_count; i++) {
+                JournalRecord record{};
+                memcpy(&record, journal_file.get_data() + sizeof(header) + i * sizeof(record), sizeof(record));
+                replay_record(record);
+            }
+
+            valid_length = sizeof(header) + record_count * sizeof(JournalRecord);
+        }
+    }
+
+    journal_writer.open_file(journal_path, generation, valid_length);
+    journal = &journal_writer;
+}
+
+std::vector<Event> TicketController::plan_reload(const std::vector<Event>& reloaded) const {
+    std::vector<Event> planned = get_event_states();
+    uint32_t loaded_count = planned.size();
+
+    for (uint32_t i = 0; i < loaded_count && i < reloaded.size(); i++) {
+        Event& event = planned[i];
+        if (reloaded[i].capacity == event.capacity) continue;
+        int32_t taken = int32_t (event.capacity) - event.ticket_count + event.deficit;
+        int32_t available = int32_t (reloaded[i].capacity) - taken;
+
+        event.capacity = reloaded[i].capacity;
+        event.deficit = std::max<int32_t>(-available, 0);
+        event.ticket_count = std::max<int32_t>(available, 0);
+    }
+
+    for (uint32_t i = loaded_count; i < reloaded.size(); i++) {
+        planned.push_back(reloaded[i]);
+    }
+
+    return planned;
+}
+
+void TicketController::reload_events(const std::vector<Event>& planned) {
+    uint32_t loaded_count = events.size();
+
+    for (uint32_t i = 0; i < loaded_count; i++) {
+        if (planned[i].capacity == events.get_capacity(i)) continue;
+
+        events.set_capacity(i, planned[i].capacity);
+        events.set_deficit(i, planned[i].deficit);
+        set_ticket_count(i, planned[i].ticket_count);
+    }
+
+    if (planned.size() <= loaded_count) return;
+
+    for (uint32_t i = loaded_count; i < planned.size(); i++) {
+        events.append(planned[i]);
+        set_ticket_count(i, planned[i].ticket_count);
+    }
+
+    delta_marks.resize(events.size());
+    build_events_message();
+    build_event_records();
+}
+
+void TicketController::restore_snapshot(const SnapshotFile& snapshot) {
+    const SnapshotHeader& header = snapshot.get_header();
+    reservations = ReservationRing(header.first_reservation_id, shard_count);
+    reservation_counter = header.reservation_counter;
+    ticket_counter = header.ticket_counter;
+
+    for (uint64_t i = 0; i < header.reservation_count; i++) {
+        SnapshotReservation stored = snapshot.get_reservation(i);
+        Reservation& reservation = i < header.parked_count ? reservations.park(stored.reservation)
+                                                           : reservations.insert(stored.reservation);
+        reservation.set_expiry_handle(WHEEL_NO_NODE);
+
+        if (!reservation.is_empty() && !reservation.is_collected()) {
+            client_holdings.hold(reservation.get_client_address(), reservation.get_ticket_count());
+        }
+
+        if (!reservation.is_empty() && reservation.is_collected()) {
+            ticket_index.add(reservation.get_tickets(), reservation.get_reservation_id());
+        }
+
+        if (!reservation.is_empty() && stored.expiry_time != 0) {
+            reservation.set_expiry_handle(expiry_wheel.schedule(reservation.get_reservation_id(),
+                                                                stored.expiry_time));
+        }
+    }
+
+    ticket_index.sort();
+}
+
+bool TicketController::save_snapshot(const std::string& snapshot_path,
+                                     const std::vector<Event>& event_states) const {
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.event_count = event_states.size();
+    header.parked_count = 0;
+
+    for (std::size_t i = 0; i < reservations.get_parked_count(); i++) {
+        if (!reservations.get_parked_record(i).is_empty()) header.parked_count += 1;
+    }
+
+    header.reservation_count = header.parked_count + reservations.size();
+    header.ticket_counter = ticket_counter;
+    header.reservation_counter = reservation_counter;
+    header.first_reservation_id = reservations.get_first_id();
+    header.journal_generation = journal != nullptr ? journal->get_generation() + 1 : 0;
+
+    std::vector<char> snapshot(sizeof(header) + header.reservation_count * sizeof(SnapshotReservation));
+    memcpy(snapshot.data(), &header, sizeof(header));
+
+    uint64_t stored_count = 0;
+
+    for (std::size_t i = 0; i < reservations.get_parked_count() + reservations.size(); i++) {
+        SnapshotReservation stored{};
+        stored.reservation = i < reservations.get_parked_count()
+                             ? reservations.get_parked_record(i)
+                             : reservations.get_record(i - reservations.get_parked_count());
+        if (i < reservations.get_parked_count() && stored.reservation.is_empty()) continue;
+
+        if (stored.reservation.get_expiry_handle() != WHEEL_NO_NODE) {
+            stored.expiry_time = expiry_wheel.get_expiration_time(stored.reservation.get_expiry_handle());
+        }
+
+        memcpy(snapshot.data() + sizeof(header) + stored_count * sizeof(stored), &stored, sizeof(stored));
+        stored_count += 1;
+    }
+
+    for (const auto& event: event_states) {
+        SnapshotEvent stored{event.ticket_count, event.capacity, event.deficit,
+                             (uint8_t) event.description.length()};
+        auto pointer_cpy = (const char*) &stored;
+        snapshot.insert(snapshot.end(), pointer_cpy, pointer_cpy + sizeof(stored));
+        snapshot.insert(snapshot.end(), event.description.begin(), event.description.end());
+    }
+
+    std::string temporary_path = snapshot_path + ".tmp";
+    int file_fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file_fd == -1) return false;
+    std::size_t written = 0;
+
+    while (written < snapshot.size()) {
+        ssize_t ret = write(file_fd, snapshot.data() + written, snapshot.size() - written);
+
+        if (ret < 0 && errno != EINTR) {
+            close(file_fd);
+            return false;
+        }
+
+        if (ret > 0) written += ret;
+    }
+
+    bool synced = fsync(file_fd) == 0;
+    close(file_fd);
+
+    return synced && rename(temporary_path.c_str(), snapshot_path.c_str()) == 0;
+}
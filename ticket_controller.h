@@ -0,0 +1,1250 @@
+#ifndef TICKET_CONTROLLER_H
+#define TICKET_CONTROLLER_H
+
+#include <iostream>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <array>
+#include <string>
+#include <string_view>
+#include <ctime>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <memory>
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/random.h>
+
+#include "ticket_protocol.h"
+
+const uint16_t MIN_PORT = 0;
+const uint16_t MAX_PORT = 65535;
+const uint16_t DEFAULT_PORT = 2022;
+
+const uint32_t MIN_TIMEOUT = 1;
+const uint32_t MAX_TIMEOUT = 86400;
+const uint32_t DEFAULT_TIMEOUT = 5;
+
+const uint32_t MIN_BATCH_SIZE = 1;
+const uint32_t MAX_BATCH_SIZE = 1024;
+const uint32_t DEFAULT_BATCH_SIZE = 0;
+
+const uint32_t MIN_TICKETS_CACHE_SIZE = 1;
+const uint32_t MAX_TICKETS_CACHE_SIZE = 1 << 30;
+const uint32_t DEFAULT_TICKETS_CACHE_SIZE = 0;
+
+const uint32_t MIN_RETENTION = 1;
+const uint32_t MAX_RETENTION = 31536000;
+const uint32_t DEFAULT_RETENTION = 0;
+
+const uint32_t MIN_WORKERS = 1;
+const uint32_t MAX_WORKERS = 64;
+const uint32_t DEFAULT_WORKERS = 0;
+
+const uint32_t MIN_STATS_INTERVAL = 1;
+const uint32_t MAX_STATS_INTERVAL = 86400;
+const uint32_t DEFAULT_STATS_INTERVAL = 0;
+
+const uint32_t MIN_TRACE_SAMPLE = 1;
+const uint32_t MAX_TRACE_SAMPLE = 1000000;
+const uint32_t DEFAULT_TRACE_SAMPLE = 100;
+
+const uint16_t MIN_ADMIN_PORT = 1;
+const uint16_t MAX_ADMIN_PORT = 65535;
+const uint16_t DEFAULT_ADMIN_PORT = 0;
+
+const uint32_t MAX_RATE_LIMIT = 1000000;
+
+const uint32_t MIN_MAX_CLIENT_TICKETS = 1;
+const uint32_t MAX_MAX_CLIENT_TICKETS = 1 << 30;
+const uint32_t DEFAULT_MAX_CLIENT_TICKETS = 0;
+
+const uint32_t JOURNAL_DURABILITY_WRITE = 0;
+const uint32_t JOURNAL_DURABILITY_TICK = 1;
+const uint32_t JOURNAL_DURABILITY_SYNC = 2;
+const uint32_t DEFAULT_DURABILITY = JOURNAL_DURABILITY_SYNC;
+
+const uint8_t TICKET_CODE_BASE = 36;
+const uint32_t COOKIES_PER_REFILL = 32;
+const uint8_t CHACHA_BLOCK_WORDS = 16;
+const uint8_t CHACHA_DOUBLE_ROUNDS = 10;
+
+constexpr const char* TICKET_DIGITS = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/*
+ *  Values of ticket code digits, and -1 for characters which are not digits.
+ */
+constexpr std::array<int8_t, 256> make_ticket_digit_values() {
+    std::array<int8_t, 256> values{};
+
+    for (auto& value: values) {
+        value = -1;
+    }
+
+    for (uint8_t i = 0; i < TICKET_CODE_BASE; i++) {
+        values[uint8_t (TICKET_DIGITS[i])] = int8_t (i);
+    }
+
+    return values;
+}
+
+constexpr std::array<int8_t, 256> TICKET_DIGIT_VALUES = make_ticket_digit_values();
+
+const std::size_t RESERVATION_RING_MIN_SIZE = 1024;
+const uint32_t CHANGE_LOG_SIZE = 4096;
+const uint8_t CLIENT_TABLE_BITS = 20;
+const uint32_t CLIENT_TABLE_SIZE = 1 << CLIENT_TABLE_BITS;
+const uint32_t CLIENT_TABLE_MAX_USED = CLIENT_TABLE_SIZE / 4 * 3;
+const std::size_t CACHE_LINE_SIZE = 64;
+const uint64_t TICKET_NUMBER_BLOCK = 1 << 16;
+
+const uint8_t WHEEL_LEVELS = 3;
+const uint8_t WHEEL_SLOT_BITS = 8;
+const uint32_t WHEEL_SLOTS = 1 << WHEEL_SLOT_BITS;
+const uint32_t WHEEL_NO_NODE = UINT32_MAX;
+
+constexpr const char* SNAPSHOT_MAGIC = "TKTSNAP";
+const uint32_t SNAPSHOT_VERSION = 7;
+
+constexpr const char* JOURNAL_MAGIC = "TKTJRNL";
+const uint32_t JOURNAL_VERSION = 1;
+
+/*
+ *  Requests are rate limited in three classes: event listings (GET_EVENTS, GET_EVENTS_PAGE and GET_EVENTS_DELTA),
+ *  GET_RESERVATION and GET_TICKETS.
+ */
+enum RateLimitClass : uint8_t {
+    LIMIT_EVENTS = 0,
+    LIMIT_RESERVATIONS = 1,
+    LIMIT_TICKETS = 2,
+    RATE_LIMIT_CLASSES = 3
+};
+
+struct ServerArgs {
+    std::string file_path;
+    uint16_t port = DEFAULT_PORT;
+    uint32_t timeout = DEFAULT_TIMEOUT;
+    uint32_t batch_size = DEFAULT_BATCH_SIZE;
+    uint32_t tickets_cache_size = DEFAULT_TICKETS_CACHE_SIZE;
+    uint32_t retention = DEFAULT_RETENTION;
+    uint32_t workers = DEFAULT_WORKERS;
+    std::string snapshot_path;
+    std::string journal_path;
+    uint32_t durability = DEFAULT_DURABILITY;
+    uint32_t stats_interval = DEFAULT_STATS_INTERVAL;
+    std::string trace_path;
+    uint32_t trace_sample = DEFAULT_TRACE_SAMPLE;
+    uint16_t admin_port = DEFAULT_ADMIN_PORT;
+    std::array<uint32_t, RATE_LIMIT_CLASSES> rate_limits{};
+    uint32_t max_client_tickets = DEFAULT_MAX_CLIENT_TICKETS;
+};
+
+/*
+ *  The capacity of an event is its number of tickets in the events file, which may be more than the number of
+ *  tickets still available. Reloading the events file changes availability by the change of capacity. When the
+ *  capacity shrinks below the number of tickets already reserved or sold, the shortfall is kept as the deficit
+ *  of the event, and returned tickets pay it off before they become available again.
+ */
+struct Event {
+    uint32_t event_id = 0;
+    std::string_view description;
+    uint16_t ticket_count = 0;
+    uint16_t capacity = 0;
+    uint16_t deficit = 0;
+};
+
+/*
+ *  Tickets of a reservation are numbered consecutively, so they are kept as a range: the first number and the
+ *  count. Ticket numbers start from 1, and a range whose first number is 0 has not been issued yet.
+ */
+class TicketRange {
+private:
+    uint64_t first_number = 0;
+    uint16_t count = 0;
+
+public:
+    TicketRange() = default;
+
+    TicketRange(uint64_t first_number, uint16_t count) : first_number(first_number), count(count) {}
+
+    [[nodiscard]] uint64_t get_first_number() const {
+        return first_number;
+    }
+
+    [[nodiscard]] uint16_t get_count() const {
+        return count;
+    }
+
+    [[nodiscard]] bool is_issued() const {
+        return first_number != 0;
+    }
+
+    [[nodiscard]] bool contains(uint64_t ticket_number) const {
+        return is_issued() && ticket_number >= first_number && ticket_number - first_number < count;
+    }
+};
+
+void generate_ticket_code(uint64_t ticket_number, char* code);
+void generate_ticket_codes(const TicketRange& tickets, char* codes);
+bool decode_ticket_code(const char* code, uint64_t* ticket_number);
+uint64_t monotonic_time_ns();
+uint32_t get_random_word();
+const char* get_request_name(uint8_t message_id);
+bool cookies_match(const char* cookie, const char* other_cookie);
+
+enum BadRequestReason : uint8_t {
+    UNKNOWN_EVENT = 0,
+    INVALID_TICKET_COUNT = 1,
+    INSUFFICIENT_TICKETS = 2,
+    UNKNOWN_RESERVATION = 3,
+    BAD_COOKIE = 4,
+    RESERVATION_EXPIRED = 5,
+    CLIENT_LIMIT = 6,
+    BAD_REQUEST_REASONS = 7
+};
+
+constexpr const char* BAD_REQUEST_REASON_NAMES[BAD_REQUEST_REASONS] = {
+        "unknown_event", "invalid_ticket_count", "insufficient_tickets", "unknown_reservation", "bad_cookie",
+        "expired", "client_limit"};
+
+/*
+ *  Events kept as a structure of arrays. The id of an event is its index, the numbers of available tickets form
+ *  one contiguous array, and descriptions are stored back to back in a single arena, addressed by offset and
+ *  length. Scans over the counts or the descriptions therefore read memory sequentially.
+ */
+class EventStore {
+private:
+    std::vector<uint16_t> ticket_counts;
+    std::vector<uint16_t> capacities;
+    std::vector<uint16_t> deficits;
+    std::vector<uint32_t> description_offsets;
+    std::vector<uint8_t> description_lengths;
+    std::vector<char> descriptions;
+
+public:
+    explicit EventStore(const std::vector<Event>& events);
+
+    void append(const Event& event);
+
+    [[nodiscard]] uint32_t size() const {
+        return ticket_counts.size();
+    }
+
+    [[nodiscard]] uint16_t get_ticket_count(uint32_t event_id) const {
+        return ticket_counts[event_id];
+    }
+
+    [[nodiscard]] std::string_view get_description(uint32_t event_id) const {
+        return {descriptions.data() + description_offsets[event_id], description_lengths[event_id]};
+    }
+
+    [[nodiscard]] uint16_t get_capacity(uint32_t event_id) const {
+        return capacities[event_id];
+    }
+
+    void set_ticket_count(uint32_t event_id, uint16_t ticket_count) {
+        ticket_counts[event_id] = ticket_count;
+    }
+
+    void set_capacity(uint32_t event_id, uint16_t capacity) {
+        capacities[event_id] = capacity;
+    }
+
+    [[nodiscard]] uint16_t get_deficit(uint32_t event_id) const {
+        return deficits[event_id];
+    }
+
+    void set_deficit(uint32_t event_id, uint16_t deficit) {
+        deficits[event_id] = deficit;
+    }
+};
+
+/*
+ *  Read-only private mapping of a whole file, unmapped when the object is destroyed. The constructor taking the
+ *  name of the file stops the server if the file can not be mapped; load reports it to the caller instead.
+ */
+class MappedFile {
+private:
+    const char* data = nullptr;
+    std::size_t size = 0;
+
+public:
+    MappedFile() = default;
+
+    MappedFile(const std::string& file_path, const std::string& name);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data != nullptr) munmap((void*) data, size);
+    }
+
+    /*
+     *  Maps the file into an object which has not mapped any file yet. Returns false if the file could not be
+     *  opened or mapped.
+     */
+    bool load(const std::string& file_path);
+
+    [[nodiscard]] const char* get_data() const {
+        return data;
+    }
+
+    [[nodiscard]] std::size_t get_size() const {
+        return size;
+    }
+};
+
+/*
+ *  Events file mapped into memory for the lifetime of the server. Descriptions of the events are views into the
+ *  mapping, so loading does not copy them. Lines are found with memchr and counts are parsed by hand. The file
+ *  given at startup is guaranteed to be correct, but a reloaded one may be caught in the middle of being
+ *  rewritten, so the structure is checked anyway: every event needs a description which fits its one octet
+ *  length and contains no zero, followed by a count of at most 65535 written in digits only.
+ */
+class EventsFile {
+private:
+    MappedFile file;
+    std::vector<Event> events;
+
+    static bool parse_ticket_count(const char* begin, const char* end, uint16_t* ticket_count);
+
+    [[nodiscard]] std::size_t count_lines() const;
+
+    bool parse_events();
+
+public:
+    EventsFile() = default;
+
+    explicit EventsFile(const std::string& file_path);
+
+    /*
+     *  Loads the file into an object which has not loaded any file yet. Returns false if the file could not be
+     *  mapped or is malformed.
+     */
+    bool load(const std::string& file_path) {
+        return file.load(file_path) && parse_events();
+    }
+
+    [[nodiscard]] const std::vector<Event>& get_events() const {
+        return events;
+    }
+};
+
+/*
+ *  Hierarchical timing wheel keyed by expiration second. Level 0 has a slot for every second of the current
+ *  256 second block, level 1 a slot for every block of the current 65536 second block and so on. Entries which
+ *  do not fit in any level wait on the overflow list. When the wheel time crosses a block boundary, the matching
+ *  slot of the upper level is cascaded down. Each slot is an intrusive doubly linked list of nodes allocated from
+ *  a pool, so an entry can be cancelled in O(1) and a fired slot never contains cancelled entries.
+ */
+class ExpiryWheel {
+private:
+    struct Node {
+        uint32_t reservation_id;
+        uint64_t expiration_time;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    std::vector<Node> nodes;
+    uint32_t free_nodes = WHEEL_NO_NODE;
+    uint32_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint32_t overflow = WHEEL_NO_NODE;
+    uint64_t wheel_time;
+
+    uint32_t* get_slot(uint64_t expiration_time) {
+        for (uint8_t level = 0; level < WHEEL_LEVELS; level++) {
+            uint8_t shift = WHEEL_SLOT_BITS * (level + 1);
+
+            if ((expiration_time >> shift) == (wheel_time >> shift)) {
+                return &slots[level][(expiration_time >> (shift - WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1)];
+            }
+        }
+
+        return &overflow;
+    }
+
+    void link(uint32_t handle) {
+        uint32_t* slot = get_slot(nodes[handle].expiration_time);
+        nodes[handle].prev = WHEEL_NO_NODE;
+        nodes[handle].next = *slot;
+        if (*slot != WHEEL_NO_NODE) nodes[*slot].prev = handle;
+        *slot = handle;
+    }
+
+    void cascade(uint32_t* slot);
+
+public:
+    explicit ExpiryWheel(uint64_t time);
+
+    [[nodiscard]] uint64_t get_time() const {
+        return wheel_time;
+    }
+
+    [[nodiscard]] uint64_t get_expiration_time(uint32_t handle) const {
+        return nodes[handle].expiration_time;
+    }
+
+    uint32_t schedule(uint32_t reservation_id, uint64_t expiration_time);
+
+    void cancel(uint32_t handle);
+
+    /*
+     *  Moves the wheel forward to the given time, calling on_expired with the reservation id of every entry that
+     *  expired on the way. Slots are detached before firing, so the callback may schedule new entries.
+     */
+    template<typename Callback>
+    void advance(uint64_t time, Callback on_expired) {
+        while (wheel_time < time) {
+            wheel_time += 1;
+
+            for (uint8_t level = WHEEL_LEVELS; level > 0; level--) {
+                uint8_t shift = WHEEL_SLOT_BITS * level;
+                if ((wheel_time & ((uint64_t(1) << shift) - 1)) != 0) continue;
+
+                if (level == WHEEL_LEVELS) {
+                    cascade(&overflow);
+                }
+                else {
+                    cascade(&slots[level][(wheel_time >> shift) & (WHEEL_SLOTS - 1)]);
+                }
+            }
+
+            uint32_t handle = slots[0][wheel_time & (WHEEL_SLOTS - 1)];
+            slots[0][wheel_time & (WHEEL_SLOTS - 1)] = WHEEL_NO_NODE;
+
+            while (handle != WHEEL_NO_NODE) {
+                uint32_t next = nodes[handle].next;
+                uint32_t reservation_id = nodes[handle].reservation_id;
+                nodes[handle].next = free_nodes;
+                free_nodes = handle;
+                on_expired(reservation_id);
+                handle = next;
+            }
+        }
+    }
+};
+
+/*
+ *  Cookies are cut from a ChaCha20 keystream keyed once with random bytes from the kernel. The keystream is
+ *  produced in chunks big enough for COOKIES_PER_REFILL cookies. Every cookie character is made from 16 bits of
+ *  the keystream with a multiply-shift, which maps them onto the allowed range without branches and lets the
+ *  compiler vectorise the loop.
+ */
+class CookieGenerator {
+private:
+    static const uint32_t COOKIE_CHARACTERS = COOKIES_PER_REFILL * COOKIE_LENGTH;
+
+    uint32_t state[CHACHA_BLOCK_WORDS];
+    uint16_t keystream[COOKIE_CHARACTERS];
+    char cookies[COOKIE_CHARACTERS];
+    uint32_t next_cookie = COOKIES_PER_REFILL;
+
+    static uint32_t rotate(uint32_t value, int shift) {
+        return (value << shift) | (value >> (32 - shift));
+    }
+
+    static void quarter_round(uint32_t* x, int a, int b, int c, int d) {
+        x[a] += x[b]; x[d] = rotate(x[d] ^ x[a], 16);
+        x[c] += x[d]; x[b] = rotate(x[b] ^ x[c], 12);
+        x[a] += x[b]; x[d] = rotate(x[d] ^ x[a], 8);
+        x[c] += x[d]; x[b] = rotate(x[b] ^ x[c], 7);
+    }
+
+    void chacha_block(uint32_t* output);
+
+    void refill();
+
+public:
+    CookieGenerator();
+
+    void generate_cookie(char* cookie);
+};
+
+/*
+ *  Reservation is a fixed size record, so that reservations can be stored by value in the reservation ring.
+ *  A record with reservation id equal to zero is empty.
+ */
+class Reservation {
+private:
+    uint32_t reservation_id = 0;
+    uint32_t event_id = 0;
+    TicketRange tickets;
+    uint64_t expiration_time = 0;
+    uint32_t expiry_handle = WHEEL_NO_NODE;
+    char cookie[COOKIE_LENGTH] = {};
+    uint32_t client_address = 0;
+
+public:
+    Reservation() = default;
+
+    Reservation(uint64_t timeout, uint32_t reservation_id, uint32_t event_id, uint16_t ticket_count, uint64_t time,
+                const char* cookie, uint32_t client_address);
+
+    [[nodiscard]] bool is_empty() const {
+        return reservation_id == 0;
+    }
+
+    [[nodiscard]] uint32_t get_reservation_id() const {
+        return reservation_id;
+    }
+
+    [[nodiscard]] uint32_t get_event_id() const {
+        return event_id;
+    }
+
+    /*
+     *  The range has its first number once the tickets have been collected.
+     */
+    [[nodiscard]] const TicketRange& get_tickets() const {
+        return tickets;
+    }
+
+    [[nodiscard]] bool is_collected() const {
+        return tickets.is_issued();
+    }
+
+    [[nodiscard]] uint16_t get_ticket_count() const {
+        return tickets.get_count();
+    }
+
+    [[nodiscard]] const char* get_cookie() const {
+        return cookie;
+    }
+
+    [[nodiscard]] uint64_t get_expiration_time() const {
+        return expiration_time;
+    }
+
+    /*
+     *  IPv4 address of the client which made the reservation, in network byte order, or 0 if it is not known.
+     */
+    [[nodiscard]] uint32_t get_client_address() const {
+        return client_address;
+    }
+
+    [[nodiscard]] uint32_t get_expiry_handle() const {
+        return expiry_handle;
+    }
+
+    void issue_tickets(uint64_t first_ticket_number) {
+        tickets = TicketRange(first_ticket_number, tickets.get_count());
+    }
+
+    void set_expiry_handle(uint32_t handle) {
+        expiry_handle = handle;
+    }
+};
+
+static_assert(std::is_trivially_copyable<Reservation>::value, "Reservation must stay a plain record");
+
+/*
+ *  Outcome of GET_RESERVATION or GET_TICKETS: the reservation, or the reason the request was rejected with.
+ *  Rejections are ordinary return values, so a flood of invalid requests costs no stack unwinding.
+ */
+class ReservationResult {
+private:
+    const Reservation* reservation;
+    BadRequestReason reason;
+
+public:
+    ReservationResult(const Reservation& reservation) : reservation(&reservation), reason(UNKNOWN_EVENT) {}
+
+    ReservationResult(BadRequestReason reason) : reservation(nullptr), reason(reason) {}
+
+    [[nodiscard]] bool is_accepted() const {
+        return reservation != nullptr;
+    }
+
+    [[nodiscard]] const Reservation& get_reservation() const {
+        return *reservation;
+    }
+
+    [[nodiscard]] BadRequestReason get_reason() const {
+        return reason;
+    }
+};
+
+/*
+ *  Reservation ids are assigned sequentially with a fixed stride (which is the number of shards), so
+ *  reservations are stored in a ring indexed by their distance from the id of the oldest stored reservation.
+ *  Removing a reservation leaves an empty record, which is dropped as soon as it reaches the front of the ring.
+ *  A collected reservation may be kept for a long time, so when it reaches the front it is parked outside the
+ *  ring instead of holding back the empty records behind it. Reservations are parked in the order of their ids,
+ *  so parked ones form a sorted array searched by id; removing one of them leaves an empty record behind, and
+ *  the array is compacted once half of it is empty. The capacity of the ring is always a power of two.
+ */
+class ReservationRing {
+private:
+    struct ParkedRecord {
+        uint32_t reservation_id;
+        Reservation reservation;
+    };
+
+    std::vector<Reservation> records;
+    std::size_t head = 0;
+    std::size_t count = 0;
+    uint32_t first_id;
+    uint32_t id_stride;
+    std::vector<ParkedRecord> parked;
+    std::size_t parked_removed = 0;
+    std::size_t live_count = 0;
+
+    Reservation& at_offset(std::size_t offset) {
+        return records[(head + offset) & (records.size() - 1)];
+    }
+
+    void grow();
+
+    Reservation* find_parked(uint32_t reservation_id);
+
+    void erase_parked(uint32_t reservation_id);
+
+public:
+    ReservationRing(uint32_t first_id, uint32_t id_stride) {
+        this->first_id = first_id;
+        this->id_stride = id_stride;
+    }
+
+    /*
+     *  Number of records in the ring, empty ones included.
+     */
+    [[nodiscard]] std::size_t size() const {
+        return count;
+    }
+
+    /*
+     *  Number of stored reservations, parked ones included.
+     */
+    [[nodiscard]] std::size_t get_live_count() const {
+        return live_count;
+    }
+
+    [[nodiscard]] uint32_t get_first_id() const {
+        return first_id;
+    }
+
+    /*
+     *  Record at the given distance from the front of the ring, which may be empty.
+     */
+    [[nodiscard]] const Reservation& get_record(std::size_t offset) const {
+        return records[(head + offset) & (records.size() - 1)];
+    }
+
+    [[nodiscard]] std::size_t get_parked_count() const {
+        return parked.size();
+    }
+
+    /*
+     *  Parked record at the given position, which may be empty.
+     */
+    [[nodiscard]] const Reservation& get_parked_record(std::size_t position) const {
+        return parked[position].reservation;
+    }
+
+    Reservation* find(uint32_t reservation_id) {
+        if (reservation_id < first_id) return find_parked(reservation_id);
+        uint32_t distance = reservation_id - first_id;
+        if (distance % id_stride != 0 || distance / id_stride >= count) return nullptr;
+        Reservation& reservation = at_offset(distance / id_stride);
+        return reservation.is_empty() ? nullptr : &reservation;
+    }
+
+    /*
+     *  The id of the inserted reservation has to be the next id after the last stored one.
+     */
+    Reservation& insert(const Reservation& reservation);
+
+    /*
+     *  Parks a collected reservation restored from a snapshot. Its id has to be greater than the ids of all
+     *  parked reservations and less than the id at the front of the ring.
+     */
+    Reservation& park(const Reservation& reservation);
+
+    void erase(uint32_t reservation_id);
+};
+
+/*
+ *  Interval index from ticket numbers to the collected reservations holding them. A controller hands out ticket
+ *  numbers in increasing order, so ranges are appended at the back of a sorted array and a ticket is found by
+ *  binary search. Only the first number and the reservation id are kept; the reservation itself tells whether
+ *  the ticket lies in its range. Entries of removed reservations are dropped once they reach the front, which
+ *  is where retention removes collected reservations from.
+ */
+class TicketIndex {
+private:
+    struct Entry {
+        uint64_t first_number;
+        uint32_t reservation_id;
+    };
+
+    std::vector<Entry> entries;
+    std::size_t head = 0;
+
+public:
+    TicketIndex() {
+        entries.reserve(RESERVATION_RING_MIN_SIZE);
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return entries.size() - head;
+    }
+
+    /*
+     *  Ranges have to be added in increasing order of their first numbers, except when the index is rebuilt,
+     *  which ends with sort().
+     */
+    void add(const TicketRange& tickets, uint32_t reservation_id) {
+        entries.push_back({tickets.get_first_number(), reservation_id});
+    }
+
+    void sort();
+
+    /*
+     *  Returns the id of the reservation whose range would hold the ticket, or 0 if there is none.
+     */
+    [[nodiscard]] uint32_t find(uint64_t ticket_number) const;
+
+    template <typename IsRemoved>
+    void trim(IsRemoved is_removed) {
+        while (head < entries.size() && is_removed(entries[head].reservation_id)) {
+            head += 1;
+        }
+
+        if (head > entries.size() / 2) {
+            entries.erase(entries.begin(), entries.begin() + head);
+            head = 0;
+        }
+    }
+};
+
+/*
+ *  Snapshot file layout: SnapshotHeader, reservation_count records of SnapshotReservation (every record of the
+ *  reservation ring from its front, empty ones included) and event_count events, each stored as SnapshotEvent
+ *  followed by the description. Numbers are stored in host byte order, so a snapshot is only meant to be read
+ *  back on the same kind of machine.
+ */
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t event_count;
+    uint64_t reservation_count;
+    uint64_t ticket_counter;
+    uint32_t reservation_counter;
+    uint32_t first_reservation_id;
+    uint64_t journal_generation;
+    uint64_t parked_count;
+};
+
+struct SnapshotReservation {
+    Reservation reservation;
+    uint64_t expiry_time;
+};
+
+struct __attribute__((__packed__)) SnapshotEvent {
+    uint16_t ticket_count;
+    uint16_t capacity;
+    uint16_t deficit;
+    uint8_t description_length;
+};
+
+/*
+ *  Snapshot mapped into memory. As with the events file, descriptions of the events are views into the mapping.
+ *  Unlike the events file, a snapshot is checked before use, and a malformed one stops the server.
+ */
+class SnapshotFile {
+private:
+    MappedFile file;
+    SnapshotHeader header{};
+    std::vector<Event> events;
+
+    [[noreturn]] static void reject() {
+        std::cerr << "Error: snapshot file is corrupted or has an unsupported version\n";
+        exit(1);
+    }
+
+    void parse_events(std::size_t position);
+
+    /*
+     *  Checks every stored reservation against the stored events and counters, so that restoring never indexes
+     *  past the events or gives back more tickets than an event can have. Parked reservations are collected ones
+     *  with increasing ids below the first id of the ring, and the record at position i of the ring has id
+     *  first_reservation_id + i or is empty, so no id can repeat.
+     */
+    void check_reservations() const;
+
+    /*
+     *  Snapshots are only written in single-threaded mode, where reservation ids go one by one, so the next id to
+     *  be handed out is the one right after the last record of the ring.
+     */
+    void check_header() const;
+
+public:
+    explicit SnapshotFile(const std::string& file_path);
+
+    [[nodiscard]] const SnapshotHeader& get_header() const {
+        return header;
+    }
+
+    [[nodiscard]] const std::vector<Event>& get_events() const {
+        return events;
+    }
+
+    [[nodiscard]] SnapshotReservation get_reservation(uint64_t index) const;
+};
+
+/*
+ *  Journal file layout: JournalHeader followed by fixed size JournalRecord entries. A snapshot stores the
+ *  generation of the journal which continues it; a journal of an older generation is already contained in the
+ *  snapshot and is not replayed. The time field holds the expiration time of a reserved reservation and the
+ *  time of collection of a collected one.
+ */
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t generation;
+};
+
+enum JournalRecordType : uint8_t {
+    JOURNAL_RESERVED = 1,
+    JOURNAL_COLLECTED = 2,
+    JOURNAL_REMOVED = 3
+};
+
+struct JournalRecord {
+    uint64_t first_ticket_number;
+    uint64_t time;
+    uint32_t reservation_id;
+    uint32_t event_id;
+    uint16_t ticket_count;
+    uint8_t type;
+    char cookie[COOKIE_LENGTH];
+    uint32_t client_address;
+};
+
+static_assert(std::is_trivially_copyable<JournalRecord>::value, "JournalRecord must stay a plain record");
+
+/*
+ *  Append-only journal of changes to reservations. Records are gathered in memory and written together by
+ *  commit, which the message sender calls before any reply leaves the server, so that a client never sees
+ *  a reservation or tickets the journal does not know about. With JOURNAL_DURABILITY_WRITE commit only hands
+ *  the records to the kernel, which survives a crash of the server but not of the machine. With
+ *  JOURNAL_DURABILITY_TICK the file is additionally synced once per expiry tick and with JOURNAL_DURABILITY_SYNC
+ *  on every commit, that is once per received batch.
+ */
+class Journal {
+private:
+    int file_fd = -1;
+    uint32_t durability;
+    uint64_t generation = 0;
+    std::vector<char> pending;
+    bool unsynced = false;
+
+    [[noreturn]] static void fail() {
+        std::cerr << "Writing journal failed. Terminating...\n";
+        exit(1);
+    }
+
+    void write_all(const char* data, std::size_t length);
+
+    void write_header();
+
+public:
+    explicit Journal(uint32_t durability) {
+        this->durability = durability;
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    ~Journal() {
+        if (file_fd != -1) close(file_fd);
+    }
+
+    [[nodiscard]] uint64_t get_generation() const {
+        return generation;
+    }
+
+    /*
+     *  Opens the journal for appending after the first valid_length bytes, which have already been replayed.
+     *  If nothing valid was replayed, the journal is started anew with the given generation.
+     */
+    void open_file(const std::string& journal_path, uint64_t journal_generation, uint64_t valid_length);
+
+    void append(const JournalRecord& record) {
+        auto pointer_cpy = (const char*) &record;
+        pending.insert(pending.end(), pointer_cpy, pointer_cpy + sizeof(record));
+    }
+
+    void commit();
+
+    /*
+     *  Called once per expiry tick.
+     */
+    void sync_tick() {
+        if (durability == JOURNAL_DURABILITY_TICK) sync();
+    }
+
+    void sync();
+
+    /*
+     *  Starts the next generation after its contents have been saved in a snapshot.
+     */
+    void restart();
+};
+
+struct alignas(CACHE_LINE_SIZE) InventorySlot {
+    std::atomic<uint16_t> ticket_count{0};
+};
+
+struct alignas(CACHE_LINE_SIZE) InventoryVersion {
+    std::atomic<uint64_t> changes{0};
+};
+
+/*
+ *  Numbers of available tickets shared by all shards in multi-threaded mode. Every event has its own counter on
+ *  a separate cache line, so that reservations of different events do not false-share. Tickets are taken with
+ *  a compare-and-swap loop, which never lets a counter go below zero, and returned with fetch_add.
+ *
+ *  Every shard counts its own changes of the inventory on its own cache line. The sum of these counters is
+ *  the version of the inventory, which other shards use to notice that their EVENTS messages are stale.
+ */
+class Inventory {
+private:
+    std::vector<InventorySlot> slots;
+    std::vector<InventoryVersion> versions;
+
+    void mark_changed(uint32_t shard_index) {
+        auto& changes = versions[shard_index].changes;
+        changes.store(changes.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+public:
+    Inventory(const std::vector<Event>& events, uint32_t shard_count);
+
+    [[nodiscard]] uint64_t get_version() const;
+
+    [[nodiscard]] uint16_t get_ticket_count(uint32_t event_id) const {
+        return slots[event_id].ticket_count.load(std::memory_order_relaxed);
+    }
+
+    bool try_take(uint32_t event_id, uint16_t ticket_count, uint32_t shard_index);
+
+    void give_back(uint32_t event_id, uint16_t ticket_count, uint32_t shard_index) {
+        slots[event_id].ticket_count.fetch_add(ticket_count, std::memory_order_relaxed);
+        mark_changed(shard_index);
+    }
+};
+
+/*
+ *  Numbers of tickets held in uncollected reservations of every client address, in an open-addressed table
+ *  with linear probing and a fixed capacity. A slot is freed as soon as its client holds no tickets, with the
+ *  rest of its cluster shifted back, so lookups never walk over tombstones. However many addresses come and go,
+ *  memory stays bounded: once the table is three quarters full, new clients are refused until some of the
+ *  reservations end. Address 0 stands for an unknown client and is never limited.
+ */
+class ClientHoldings {
+private:
+    struct Slot {
+        uint32_t address;
+        uint32_t tickets;
+    };
+
+    std::vector<Slot> slots;
+    std::size_t used = 0;
+    uint32_t limit;
+
+    static std::size_t get_home(uint32_t address) {
+        return (address * 2654435769u) >> (32 - CLIENT_TABLE_BITS);
+    }
+
+    /*
+     *  Returns the slot of the address, or the free slot which would receive it.
+     */
+    [[nodiscard]] std::size_t find(uint32_t address) const;
+
+    void erase(std::size_t hole) {
+        std::size_t next = (hole + 1) & (CLIENT_TABLE_SIZE - 1);
+
+        for (; slots[next].address != 0; next = (next + 1) & (CLIENT_TABLE_SIZE - 1)) {
+            std::size_t home = get_home(slots[next].address);
+
+            if (((next - home) & (CLIENT_TABLE_SIZE - 1)) >= ((next - hole) & (CLIENT_TABLE_SIZE - 1))) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+        }
+
+        slots[hole] = Slot{};
+        used -= 1;
+    }
+
+public:
+    explicit ClientHoldings(uint32_t limit) : limit(limit) {
+        if (limit > 0) slots.resize(CLIENT_TABLE_SIZE);
+    }
+
+    [[nodiscard]] bool can_hold(uint32_t address, uint16_t ticket_count) const;
+
+    void hold(uint32_t address, uint16_t ticket_count);
+
+    void release(uint32_t address, uint16_t ticket_count) {
+        if (slots.empty() || address == 0) return;
+
+        std::size_t index = find(address);
+        Slot& slot = slots[index];
+        if (slot.address == 0) return;
+
+        slot.tickets -= std::min<uint32_t>(slot.tickets, ticket_count);
+        if (slot.tickets == 0) erase(index);
+    }
+};
+
+class TicketController {
+private:
+    ExpiryWheel expiry_wheel;
+    CookieGenerator cookie_generator;
+    ReservationRing reservations;
+    EventStore events;
+    std::vector<char> events_message;
+    std::vector<uint32_t> ticket_count_offsets;
+    std::vector<char> event_records;
+    std::vector<uint32_t> record_offsets;
+    std::vector<uint32_t> change_log;
+    uint64_t counts_version;
+    uint64_t first_counts_version;
+    std::vector<uint64_t> delta_marks;
+    uint64_t delta_serial = 0;
+    uint64_t ticket_counter = 1;
+    uint64_t ticket_block_end = UINT64_MAX;
+    uint64_t next_ticket_block;
+    TicketIndex ticket_index;
+    uint32_t reservation_counter;
+    uint64_t timeout;
+    uint64_t retention;
+    uint32_t shard_index;
+    uint32_t shard_count;
+    Inventory* inventory;
+    uint64_t events_version = 0;
+    Journal* journal = nullptr;
+    ClientHoldings client_holdings;
+    uint64_t expired_count = 0;
+    uint64_t retired_count = 0;
+
+    /*
+     *  The EVENTS message is encoded once, at load time. Events are appended as long as they fit in a single
+     *  datagram and for every appended event we remember where its ticket_count field lies, so that later changes
+     *  of the number of available tickets only patch these two bytes.
+     */
+    void build_events_message();
+
+    /*
+     *  Besides the GET_EVENTS reply, the records of all events are encoded back to back in one catalog, from
+     *  which pages of events are copied. Ticket counts in the catalog are not kept up to date; they are filled
+     *  in from the current counts whenever a record is copied.
+     */
+    void build_event_records();
+
+    /*
+     *  Copy of every event as it is now. Descriptions are views into the event store.
+     */
+    [[nodiscard]] std::vector<Event> get_event_states() const;
+
+    [[nodiscard]] uint16_t get_available_tickets(uint32_t event_id) const {
+        if (inventory != nullptr) return inventory->get_ticket_count(event_id);
+        return events.get_ticket_count(event_id);
+    }
+
+    void patch_events_message(uint32_t event_id, uint16_t ticket_count);
+
+    /*
+     *  Every change of a ticket count gets the next version of the counts, and the id of the changed event is
+     *  written at that version in the change log, which keeps the last CHANGE_LOG_SIZE changes. Versions start
+     *  from a random word shifted left by 32 bits, so versions seen before a restart, even one within the same
+     *  second, fall outside the change log.
+     */
+    void set_ticket_count(uint32_t event_id, uint16_t ticket_count) {
+        events.set_ticket_count(event_id, ticket_count);
+        patch_events_message(event_id, ticket_count);
+        counts_version += 1;
+        change_log[counts_version & (CHANGE_LOG_SIZE - 1)] = event_id;
+    }
+
+    /*
+     *  In multi-threaded mode the shared inventory is the only source of ticket counts. The EVENTS message is
+     *  patched from it before sending, but only if the inventory changed since the last refresh.
+     */
+    void refresh_events_message();
+
+    bool take_tickets(uint32_t event_id, uint16_t ticket_count);
+
+    void return_tickets(uint32_t event_id, uint16_t ticket_count);
+
+    /*
+     *  In multi-threaded mode ticket numbers come in blocks, and shard i takes blocks i, i + shard_count and so
+     *  on. The shard holding a ticket is thus known from its number alone, without any shared counter.
+     */
+    TicketRange take_ticket_numbers(uint16_t ticket_count);
+
+    Reservation& add_reservation(Reservation reservation);
+
+    void collect_reservation(Reservation& reservation, uint64_t first_ticket_number, uint64_t time);
+
+    void remove_reservation(const Reservation& reservation);
+
+    void log_change(JournalRecordType type, const Reservation& reservation, uint64_t time) {
+        if (journal == nullptr) return;
+
+        JournalRecord record{};
+        record.type = type;
+        record.reservation_id = reservation.get_reservation_id();
+        record.event_id = reservation.get_event_id();
+        record.ticket_count = reservation.get_ticket_count();
+        record.first_ticket_number = reservation.get_tickets().get_first_number();
+        record.time = time;
+        memcpy(record.cookie, reservation.get_cookie(), COOKIE_LENGTH);
+        record.client_address = reservation.get_client_address();
+        journal->append(record);
+    }
+
+    [[noreturn]] static void reject_journal() {
+        std::cerr << "Error: journal file is corrupted or does not belong to the restored state\n";
+        exit(1);
+    }
+
+    /*
+     *  Applies a journal record the same way the original request changed the state, without journaling it again.
+     *  The ticket counters are only moved forward, as they may already be past the record after a snapshot.
+     */
+    void replay_record(const JournalRecord& record);
+
+public:
+    TicketController(const ServerArgs& server_args, const std::vector<Event>& events) :
+            TicketController(server_args, events, 0, 1, nullptr) {}
+
+    /*
+     *  Controller of a single shard. The shard takes tickets of any event from the shared inventory and creates
+     *  reservations with ids congruent to ID_LIMIT + 1 + shard index modulo the number of shards.
+     */
+    TicketController(const ServerArgs& server_args, const std::vector<Event>& events, uint32_t shard_index,
+                     uint32_t shard_count, Inventory* inventory);
+
+    /*
+     *  Every uncollected reservation is scheduled in the expiry wheel. The main loop advances the wheel once per
+     *  second tick. If the time set for collecting the reservation has passed, we remove it from the ring of
+     *  reservations and return tickets to the bank of available tickets. When a reservation is collected, it is
+     *  cancelled in the wheel, or rescheduled to the end of its retention time if retention is limited. Collected
+     *  reservations which reach the end of their retention time are removed from the ring.
+     */
+    void remove_expired_reservations(uint64_t time);
+
+    const std::vector<char>& get_events() {
+        if (inventory != nullptr) refresh_events_message();
+        return events_message;
+    }
+
+    /*
+     *  Writes an EVENTS message with as many events as fit in a datagram, starting from the given event id and
+     *  skipping sold out events if the client asked for available ones only. The buffer has to have room for
+     *  a whole datagram. Returns the length of the message.
+     */
+    std::size_t write_events_page(EventsPageRequest request, char* buffer) const;
+
+    /*
+     *  Writes an EVENTS_DELTA message with the current ticket counts of events changed after the client's
+     *  version. If the change log no longer covers that version, or in multi-threaded mode, where the counts are
+     *  shared and have no common log, the message carries counts of the first events instead, as many as fit in
+     *  a datagram, and is marked truncated if some events did not fit. The change log is short enough for every
+     *  delta to fit in a datagram. Returns the length of the message.
+     */
+    std::size_t write_events_delta(EventsDeltaRequest request, char* buffer);
+
+    /*
+     *  With a limit of tickets per client, a client whose uncollected reservations already hold too many tickets
+     *  is refused before any tickets are taken.
+     */
+    ReservationResult get_reservation(ReservationRequest request, uint32_t client_address, uint64_t time);
+
+    /*
+     *  Expiry runs on the wheel tick, so a reservation may still be present for a moment after its expiration
+     *  time. Such reservation is treated as already expired.
+     */
+    ReservationResult get_tickets(TicketsRequest request, uint64_t time);
+
+    /*
+     *  Finds the reservation holding the ticket with the given code, without generating any codes: the code
+     *  is decoded to its number, which the ticket index maps to the only reservation that may hold it. Returns
+     *  nullptr if the code is malformed or the ticket was never issued by this controller or has been retired.
+     */
+    [[nodiscard]] const Reservation* validate_ticket(TicketValidationRequest request);
+
+    [[nodiscard]] Journal* get_journal() const {
+        return journal;
+    }
+
+    [[nodiscard]] uint32_t get_shard_index() const {
+        return shard_index;
+    }
+
+    [[nodiscard]] std::size_t get_reservation_count() const {
+        return reservations.get_live_count();
+    }
+
+    [[nodiscard]] uint64_t get_expired_count() const {
+        return expired_count;
+    }
+
+    [[nodiscard]] uint64_t get_retired_count() const {
+        return retired_count;
+    }
+
+    /*
+     *  Replays the journal of the given generation, if there is one, and attaches the journal to the controller,
+     *  so that all later changes are appended to it. A torn record at the end of the journal, left by a crash in
+     *  the middle of a write, was never committed, so it is dropped.
+     */
+    void open_journal(Journal& journal_writer, const std::string& journal_path, uint64_t generation);
+
+    /*
+     *  Works out the events after reloading the events file in single-threaded mode, without applying them, so
+     *  that they can be saved in a snapshot first. Events keep their ids. The tickets of an existing event which
+     *  are reserved or sold stay taken, so the new capacity minus them is available; if they exceed the new
+     *  capacity, nothing is available and the excess becomes the deficit of the event. Events past the end of
+     *  the current list are appended. Events missing from the reloaded file keep their tickets, and descriptions
+     *  are never changed. Outstanding reservations are not touched.
+     */
+    [[nodiscard]] std::vector<Event> plan_reload(const std::vector<Event>& reloaded) const;
+
+    /*
+     *  Applies events planned by plan_reload, with no change of the state in between.
+     */
+    void reload_events(const std::vector<Event>& planned);
+
+    /*
+     *  Replaces the reservations of a freshly constructed controller with the ones stored in the snapshot. The
+     *  events are expected to have been loaded from the same snapshot. Reservations which expired while the
+     *  server was down are scheduled for the next wheel tick, so their tickets return to the pool right away.
+     */
+    void restore_snapshot(const SnapshotFile& snapshot);
+
+    bool save_snapshot(const std::string& snapshot_path) const {
+        return save_snapshot(snapshot_path, get_event_states());
+    }
+
+    /*
+     *  Writes the reservations of the controller with the given events to a temporary file next to the snapshot
+     *  and renames it over the snapshot, so that a crash during the dump never leaves a partial snapshot behind.
+     */
+    bool save_snapshot(const std::string& snapshot_path, const std::vector<Event>& event_states) const;
+};
+
+#endif // TICKET_CONTROLLER_H
@@ -0,0 +1,260 @@
+#include "ticket_controller.h"
+
+MappedFile::MappedFile(const std::string& file_path, const std::string& name) {
+    if (!load(file_path)) {
+        std::cerr << "Could not open " << name << " file\n";
+        exit(1);
+    }
+}
+
+bool MappedFile::load(const std::string& file_path) {
+    int file_fd = open(file_path.c_str(), O_RDONLY);
+    struct stat file_stat{};
+    if (file_fd == -1) return false;
+
+    if (fstat(file_fd, &file_stat) == -1) {
+        close(file_fd);
+        return false;
+    }
+
+    if (file_stat.st_size > 0) {
+        void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file_fd, 0);
+
+        if (mapping == MAP_FAILED) {
+            close(file_fd);
+            return false;
+        }
+
+        madvise(mapping, file_stat.st_size, MADV_SEQUENTIAL);
+        data = (const char*) mapping;
+        size = file_stat.st_size;
+    }
+
+    close(file_fd);
+
+    return true;
+}
+
+bool EventsFile::parse_ticket_count(const char* begin, const char* end, uint16_t* ticket_count) {
+    uint32_t count = 0;
+    if (begin == end) return false;
+
+    for (; begin < end; begin++) {
+        if (*begin < '0' || *begin > '9') return false;
+        count = count * 10 + (*begin - '0');
+        if (count > UINT16_MAX) return false;
+    }
+
+    *ticket_count = count;
+
+    return true;
+}
+
+std::size_t EventsFile::count_lines() const {
+    std::size_t lines = 0;
+    const char* position = file.get_data();
+    const char* end = position + file.get_size();
+
+    while ((position = (const char*) memchr(position, '\n', end - position)) != nullptr) {
+        lines += 1;
+        position += 1;
+    }
+
+    return lines + 1;
+}
+
+bool EventsFile::parse_events() {
+    if (file.get_size() == 0) return true;
+
+    events.reserve(count_lines() / 2);
+    const char* position = file.get_data();
+    const char* end = position + file.get_size();
+
+    while (position < end) {
+        auto description_end = (const char*) memchr(position, '\n', end - position);
+        if (description_end == nullptr) return false;
+
+        auto count_end = (const char*) memchr(description_end + 1, '\n', end - description_end - 1);
+        if (count_end == nullptr) count_end = end;
+
+        std::size_t description_length = description_end - position;
+        if (description_length == 0 || description_length > UINT8_MAX) return false;
+        if (memchr(position, '\0', description_length) != nullptr) return false;
+        if (events.size() > ID_LIMIT) return false;
+
+        Event event;
+        event.event_id = events.size();
+        event.description = std::string_view(position, description_length);
+        if (!parse_ticket_count(description_end + 1, count_end, &event.ticket_count)) return false;
+        event.capacity = event.ticket_count;
+        events.push_back(event);
+
+        position = count_end == end ? end : count_end + 1;
+    }
+
+    return true;
+}
+
+EventsFile::EventsFile(const std::string& file_path) : file(file_path, "events") {
+    if (!parse_events()) {
+        std::cerr << "Error: events file is malformed\n";
+        exit(1);
+    }
+}
+
+void SnapshotFile::parse_events(std::size_t position) {
+    const char* data = file.get_data();
+    events.reserve(header.event_count);
+
+    for (uint32_t i = 0; i < header.event_count; i++) {
+        SnapshotEvent stored{};
+        if (position + sizeof(stored) > file.get_size()) reject();
+        memcpy(&stored, data + position, sizeof(stored));
+        position += sizeof(stored);
+        if (position + stored.description_length > file.get_size()) reject();
+
+        Event event;
+        event.event_id = i;
+        event.description = std::string_view(data + position, stored.description_length);
+        event.ticket_count = stored.ticket_count;
+        event.capacity = stored.capacity;
+        event.deficit = stored.deficit;
+        if (event.ticket_count > event.capacity) reject();
+        events.push_back(event);
+        position += stored.description_length;
+    }
+
+    if (position != file.get_size()) reject();
+}
+
+void SnapshotFile::check_reservations() const {
+    std::vector<uint32_t> held(events.size(), 0);
+    uint32_t previous_id = ID_LIMIT;
+
+    for (uint64_t i = 0; i < header.reservation_count; i++) {
+        SnapshotReservation stored = get_reservation(i);
+        const Reservation& reservation = stored.reservation;
+        bool parked = i < header.parked_count;
+
+        if (reservation.is_empty()) {
+            if (parked) reject();
+            continue;
+        }
+
+        uint32_t reservation_id = reservation.get_reservation_id();
+
+        if (parked) {
+            if (reservation_id <= previous_id || reservation_id >= header.first_reservation_id) reject();
+            if (!reservation.is_collected()) reject();
+            previous_id = reservation_id;
+        }
+        else if (reservation_id - header.first_reservation_id != i - header.parked_count) {
+            reject();
+        }
+
+        if (reservation_id <= ID_LIMIT || reservation_id >= header.reservation_counter) reject();
+        if (reservation.get_event_id() >= events.size()) reject();
+
+        uint16_t ticket_count = reservation.get_ticket_count();
+        if (ticket_count == 0 || uint64_t (TICKET_LENGTH) * ticket_count + 7 > UDP_DATAGRAM_MAX_SIZE) reject();
+
+        if (reservation.is_collected()) {
+            if (reservation.get_tickets().get_first_number() + ticket_count > header.ticket_counter) reject();
+        }
+        else {
+            if (stored.expiry_time == 0) reject();
+            held[reservation.get_event_id()] += ticket_count;
+        }
+    }
+
+    for (const auto& event: events) {
+        if (held[event.event_id] + event.ticket_count > uint32_t (event.capacity) + event.deficit) reject();
+    }
+}
+
+void SnapshotFile::check_header() const {
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) reject();
+    if (header.version != SNAPSHOT_VERSION) reject();
+    if (header.reservation_count > (file.get_size() - sizeof(header)) / sizeof(SnapshotReservation)) reject();
+    if (header.parked_count > header.reservation_count) reject();
+    if (header.first_reservation_id <= ID_LIMIT || header.ticket_counter < 1) reject();
+
+    uint64_t ring_count = header.reservation_count - header.parked_count;
+    if (header.reservation_counter != uint64_t (header.first_reservation_id) + ring_count) reject();
+}
+
+SnapshotFile::SnapshotFile(const std::string& file_path) : file(file_path, "snapshot") {
+    if (file.get_size() < sizeof(header)) reject();
+    memcpy(&header, file.get_data(), sizeof(header));
+
+    check_header();
+    parse_events(sizeof(header) + header.reservation_count * sizeof(SnapshotReservation));
+    check_reservations();
+}
+
+SnapshotReservation SnapshotFile::get_reservation(uint64_t index) const {
+    SnapshotReservation stored{};
+    memcpy(&stored, file.get_data() + sizeof(header) + index * sizeof(stored), sizeof(stored));
+
+    return stored;
+}
+
+void Journal::write_all(const char* data, std::size_t length) {
+    std::size_t written = 0;
+
+    while (written < length) {
+        ssize_t ret = write(file_fd, data + written, length - written);
+        if (ret < 0 && errno != EINTR) fail();
+        if (ret > 0) written += ret;
+    }
+}
+
+void Journal::write_header() {
+    JournalHeader header{};
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    header.generation = generation;
+
+    if (ftruncate(file_fd, 0) == -1 || lseek(file_fd, 0, SEEK_SET) == -1) fail();
+    write_all((const char*) &header, sizeof(header));
+    if (fsync(file_fd) == -1) fail();
+}
+
+void Journal::open_file(const std::string& journal_path, uint64_t journal_generation, uint64_t valid_length) {
+    file_fd = open(journal_path.c_str(), O_WRONLY | O_CREAT, 0644);
+
+    if (file_fd == -1) {
+        std::cerr << "Could not open journal file\n";
+        exit(1);
+    }
+
+    generation = journal_generation;
+
+    if (valid_length < sizeof(JournalHeader)) {
+        write_header();
+    }
+    else if (ftruncate(file_fd, valid_length) == -1 || lseek(file_fd, 0, SEEK_END) == -1) {
+        fail();
+    }
+}
+
+void Journal::commit() {
+    if (pending.empty()) return;
+    write_all(pending.data(), pending.size());
+    pending.clear();
+    unsynced = true;
+
+    if (durability == JOURNAL_DURABILITY_SYNC) sync();
+}
+
+void Journal::sync() {
+    if (!unsynced) return;
+    if (fdatasync(file_fd) == -1) fail();
+    unsynced = false;
+}
+
+void Journal::restart() {
+    commit();
+    generation += 1;
+    write_header();
+}
@@ -0,0 +1,301 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <array>
+#include <string>
+
+#include "ticket_protocol.h"
+#include "ticket_controller.h"
+#include "allocation_counter.h"
+
+constexpr const char* USAGE_ERROR_MESSAGE = "Usage: [<name_filter>]\n";
+
+const uint64_t NANOSECONDS_IN_SECOND = 1000000000;
+const uint32_t BENCH_EVENT_COUNT = 100;
+const uint32_t PAGE_EVENT_COUNT = 10000;
+const uint32_t BENCH_CLIENT_ADDRESS = 0x0100007f;
+const std::array<uint32_t, 3> RESERVATION_COUNTS = {1000, 100000, 1000000};
+const std::array<uint32_t, 3> EXPIRY_DEPTHS = {1000, 100000, 1000000};
+const std::array<uint32_t, 2> COLLECTED_COUNTS = {1000, 1000000};
+const uint16_t COLLECTED_TICKET_COUNT = 4;
+
+/*
+ *  Keeps the compiler from optimising away a result which is never used.
+ */
+template <typename T>
+void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/*
+ *  Runs body, which performs the given number of operations, and prints the time and the allocations per
+ *  operation. Only the body is measured, so benchmarks prepare their state before calling it.
+ */
+template <typename Body>
+void measure(const std::string& name, uint64_t operations, Body&& body) {
+    uint64_t allocations_before = thread_allocations;
+    uint64_t start_time = monotonic_time_ns();
+    body();
+    uint64_t elapsed = monotonic_time_ns() - start_time;
+    uint64_t allocated = thread_allocations - allocations_before;
+
+    std::cout << std::left << std::setw(40) << name << std::right << std::fixed
+              << std::setw(12) << std::setprecision(1) << double (elapsed) / operations << " ns/op"
+              << std::setw(12) << std::setprecision(3) << double (allocated) / operations << " allocs/op"
+              << std::setw(14) << std::setprecision(0) << double (operations) * NANOSECONDS_IN_SECOND / elapsed
+              << " ops/s\n";
+}
+
+/*
+ *  Events with the largest possible number of tickets, so that one event can hold many reservations.
+ */
+class BenchEvents {
+private:
+    std::vector<std::string> descriptions;
+    std::vector<Event> events;
+
+public:
+    explicit BenchEvents(uint32_t event_count) {
+        descriptions.reserve(event_count);
+
+        for (uint32_t i = 0; i < event_count; i++) {
+            descriptions.push_back("benchmark event number " + std::to_string(i));
+
+            Event event;
+            event.event_id = i;
+            event.description = descriptions.back();
+            event.ticket_count = UINT16_MAX;
+            event.capacity = UINT16_MAX;
+            events.push_back(event);
+        }
+    }
+
+    [[nodiscard]] const std::vector<Event>& get_events() const {
+        return events;
+    }
+};
+
+GetReservationMessage make_reservation_message(uint32_t event_id, uint16_t ticket_count) {
+    GetReservationMessage message{};
+    message.event_id = htonl(event_id);
+    message.ticket_count = htons(ticket_count);
+
+    return message;
+}
+
+/*
+ *  Takes single tickets from consecutive events, so that count reservations fit in the events.
+ */
+void reserve(TicketController& ticket_controller, uint32_t event_count, uint64_t count, uint64_t time) {
+    for (uint64_t i = 0; i < count; i++) {
+        GetReservationMessage message = make_reservation_message(i % event_count, 1);
+        keep(ticket_controller.get_reservation(ReservationRequest(message), BENCH_CLIENT_ADDRESS, time));
+    }
+}
+
+void bench_generate_cookie() {
+    const uint64_t operations = 10000000;
+    CookieGenerator cookie_generator;
+    char cookie[COOKIE_LENGTH];
+
+    measure("generate_cookie", operations, [&]() {
+        for (uint64_t i = 0; i < operations; i++) {
+            cookie_generator.generate_cookie(cookie);
+            keep(cookie);
+        }
+    });
+}
+
+void bench_cookies_match() {
+    const uint64_t operations = 10000000;
+    CookieGenerator cookie_generator;
+    char cookie[COOKIE_LENGTH];
+    char other_cookie[COOKIE_LENGTH];
+    cookie_generator.generate_cookie(cookie);
+    memcpy(other_cookie, cookie, COOKIE_LENGTH);
+
+    measure("cookies_match", operations, [&]() {
+        for (uint64_t i = 0; i < operations; i++) {
+            keep(cookie);
+            keep(cookies_match(cookie, other_cookie));
+        }
+    });
+}
+
+void bench_generate_ticket_code() {
+    const uint64_t operations = 10000000;
+    char code[TICKET_LENGTH];
+
+    measure("generate_ticket_code", operations, [&]() {
+        for (uint64_t i = 0; i < operations; i++) {
+            generate_ticket_code(i, code);
+            keep(code);
+        }
+    });
+
+    const uint16_t ticket_count = (UDP_DATAGRAM_MAX_SIZE - 7) / TICKET_LENGTH;
+    const uint64_t ranges = 10000;
+    std::vector<char> codes(ticket_count * TICKET_LENGTH);
+
+    measure("generate_ticket_code (range, per ticket)", ranges * ticket_count, [&]() {
+        for (uint64_t i = 0; i < ranges; i++) {
+            for (uint16_t j = 0; j < ticket_count; j++) {
+                generate_ticket_code(1 + i * ticket_count + j, codes.data() + j * TICKET_LENGTH);
+            }
+            keep(codes.data());
+        }
+    });
+
+    measure("generate_ticket_codes (per ticket)", ranges * ticket_count, [&]() {
+        for (uint64_t i = 0; i < ranges; i++) {
+            generate_ticket_codes(TicketRange(1 + i * ticket_count, ticket_count), codes.data());
+            keep(codes.data());
+        }
+    });
+}
+
+/*
+ *  GET_EVENTS together with the framing of the reply, which in batched mode is a copy into the send buffer.
+ */
+void bench_get_events() {
+    const uint64_t operations = 1000000;
+    ServerArgs server_args;
+    BenchEvents events(BENCH_EVENT_COUNT);
+    TicketController ticket_controller(server_args, events.get_events());
+    std::vector<char> datagram(UDP_DATAGRAM_MAX_SIZE);
+
+    measure("get_events/" + std::to_string(BENCH_EVENT_COUNT), operations, [&]() {
+        for (uint64_t i = 0; i < operations; i++) {
+            const std::vector<char>& events_message = ticket_controller.get_events();
+            memcpy(datagram.data(), events_message.data(), events_message.size());
+            keep(datagram.data());
+        }
+    });
+}
+
+void bench_write_events_page() {
+    const uint64_t operations = 10000;
+    ServerArgs server_args;
+    BenchEvents events(PAGE_EVENT_COUNT);
+    TicketController ticket_controller(server_args, events.get_events());
+    std::vector<char> datagram(UDP_DATAGRAM_MAX_SIZE);
+    GetEventsPageMessage message{};
+
+    measure("write_events_page/" + std::to_string(PAGE_EVENT_COUNT), operations, [&]() {
+        for (uint64_t i = 0; i < operations; i++) {
+            keep(ticket_controller.write_events_page(EventsPageRequest(message), datagram.data()));
+        }
+    });
+}
+
+void bench_get_reservation() {
+    const uint64_t operations = 100000;
+
+    for (uint32_t reservation_count : RESERVATION_COUNTS) {
+        ServerArgs server_args;
+        server_args.timeout = MAX_TIMEOUT;
+        uint32_t event_count = (reservation_count + operations) / UINT16_MAX + 1;
+        BenchEvents events(event_count);
+        TicketController ticket_controller(server_args, events.get_events());
+        uint64_t time = std::time(nullptr);
+        reserve(ticket_controller, event_count, reservation_count, time);
+
+        measure("get_reservation/" + std::to_string(reservation_count), operations, [&]() {
+            reserve(ticket_controller, event_count, operations, time);
+        });
+    }
+}
+
+/*
+ *  All reservations expire in the same second, so a single tick removes the whole queue.
+ */
+void bench_remove_expired_reservations() {
+    for (uint32_t depth : EXPIRY_DEPTHS) {
+        ServerArgs server_args;
+        server_args.timeout = MIN_TIMEOUT;
+        uint32_t event_count = depth / UINT16_MAX + 1;
+        BenchEvents events(event_count);
+        TicketController ticket_controller(server_args, events.get_events());
+        uint64_t time = std::time(nullptr);
+        reserve(ticket_controller, event_count, depth, time);
+
+        measure("remove_expired_reservations/" + std::to_string(depth), depth, [&]() {
+            ticket_controller.remove_expired_reservations(time + MIN_TIMEOUT);
+        });
+    }
+}
+
+/*
+ *  Codes of tickets spread over all collected reservations, so that lookups do not hit the same entries.
+ */
+void bench_validate_ticket() {
+    const uint64_t operations = 1000000;
+    const uint64_t stride = 7919;
+
+    for (uint32_t collected_count : COLLECTED_COUNTS) {
+        ServerArgs server_args;
+        uint32_t event_count = uint64_t (collected_count) * COLLECTED_TICKET_COUNT / UINT16_MAX + 1;
+        BenchEvents events(event_count);
+        TicketController ticket_controller(server_args, events.get_events());
+        uint64_t time = std::time(nullptr);
+
+        for (uint32_t i = 0; i < collected_count; i++) {
+            GetReservationMessage reservation_message = make_reservation_message(i % event_count,
+                                                                                 COLLECTED_TICKET_COUNT);
+            ReservationResult reserved = ticket_controller.get_reservation(ReservationRequest(reservation_message),
+                                                                           BENCH_CLIENT_ADDRESS, time);
+            GetTicketsMessage tickets_message{};
+            tickets_message.reservation_id = htonl(reserved.get_reservation().get_reservation_id());
+            memcpy(tickets_message.cookie, reserved.get_reservation().get_cookie(), COOKIE_LENGTH);
+            keep(ticket_controller.get_tickets(TicketsRequest(tickets_message), time));
+        }
+
+        uint64_t ticket_total = uint64_t (collected_count) * COLLECTED_TICKET_COUNT;
+        std::vector<ValidateTicketMessage> messages(operations);
+
+        for (uint64_t i = 0; i < operations; i++) {
+            generate_ticket_code(1 + (i * stride) % ticket_total, messages[i].ticket);
+        }
+
+        measure("validate_ticket/" + std::to_string(collected_count), operations, [&]() {
+            for (uint64_t i = 0; i < operations; i++) {
+                keep(ticket_controller.validate_ticket(TicketValidationRequest(messages[i])));
+            }
+        });
+    }
+}
+
+struct Benchmark {
+    const char* name;
+    void (*run)();
+};
+
+const std::array<Benchmark, 8> BENCHMARKS = {{
+        {"generate_cookie", bench_generate_cookie},
+        {"cookies_match", bench_cookies_match},
+        {"generate_ticket_code", bench_generate_ticket_code},
+        {"get_events", bench_get_events},
+        {"write_events_page", bench_write_events_page},
+        {"get_reservation", bench_get_reservation},
+        {"remove_expired_reservations", bench_remove_expired_reservations},
+        {"validate_ticket", bench_validate_ticket},
+}};
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        std::cerr << USAGE_ERROR_MESSAGE;
+        exit(1);
+    }
+
+    std::string filter = argc == 2 ? argv[1] : "";
+
+    for (const Benchmark& benchmark : BENCHMARKS) {
+        if (std::string(benchmark.name).find(filter) == std::string::npos) continue;
+        benchmark.run();
+    }
+
+    return 0;
+}
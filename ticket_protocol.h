@@ -0,0 +1,220 @@
+#ifndef TICKET_PROTOCOL_H
+#define TICKET_PROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <arpa/inet.h>
+#include <endian.h>
+
+const uint8_t TICKET_LENGTH = 7;
+const uint8_t BEG_COOKIE = 33;
+const uint8_t END_COOKIE = 126;
+const uint8_t COOKIE_LENGTH = 48;
+
+const uint32_t ID_LIMIT = 999999;
+const uint64_t UDP_DATAGRAM_MAX_SIZE = 65507;
+
+enum MessageID : uint8_t {
+    GET_EVENTS = 1,
+    EVENTS = 2,
+    GET_RESERVATION = 3,
+    RESERVATION = 4,
+    GET_TICKETS = 5,
+    TICKETS = 6,
+    GET_EVENTS_PAGE = 7,
+    GET_EVENTS_DELTA = 8,
+    EVENTS_DELTA = 9,
+    VALIDATE_TICKET = 10,
+    TICKET_STATUS = 11,
+    BAD_REQUEST = 255
+};
+
+struct __attribute__((__packed__)) GetReservationMessage {
+    uint32_t event_id;
+    uint16_t ticket_count;
+};
+
+struct __attribute__((__packed__)) GetTicketsMessage {
+    uint32_t reservation_id;
+    char cookie[COOKIE_LENGTH];
+};
+
+struct __attribute__((__packed__)) GetEventsPageMessage {
+    uint32_t first_event_id;
+    uint8_t only_available;
+};
+
+struct __attribute__((__packed__)) GetEventsDeltaMessage {
+    uint64_t version;
+};
+
+struct __attribute__((__packed__)) ValidateTicketMessage {
+    char ticket[TICKET_LENGTH];
+};
+
+struct ReceivedMessage {
+    MessageID message_id;
+    union {
+        GetReservationMessage reservation_msg;
+        GetTicketsMessage tickets_msg;
+        GetEventsPageMessage events_page_msg;
+        GetEventsDeltaMessage events_delta_msg;
+        ValidateTicketMessage validate_ticket_msg;
+    };
+};
+
+/*
+ *  Returns the exact length of a request with the given message_id, or 0 for ids which are not requests.
+ */
+inline std::size_t get_request_length(uint8_t message_id) {
+    switch (message_id) {
+        case MessageID::GET_EVENTS:
+            return 1;
+        case MessageID::GET_RESERVATION:
+            return 1 + sizeof(GetReservationMessage);
+        case MessageID::GET_TICKETS:
+            return 1 + sizeof(GetTicketsMessage);
+        case MessageID::GET_EVENTS_PAGE:
+            return 1 + sizeof(GetEventsPageMessage);
+        case MessageID::GET_EVENTS_DELTA:
+            return 1 + sizeof(GetEventsDeltaMessage);
+        case MessageID::VALIDATE_TICKET:
+            return 1 + sizeof(ValidateTicketMessage);
+        default:
+            return 0;
+    }
+}
+
+/*
+ *  Views of requests decoded in place. A view refers to the received datagram and converts a field to host byte
+ *  order only when it is read, so a request reaches the controller without being copied.
+ */
+class ReservationRequest {
+private:
+    const GetReservationMessage& message;
+
+public:
+    explicit ReservationRequest(const GetReservationMessage& message) : message(message) {}
+
+    [[nodiscard]] uint32_t get_event_id() const {
+        return ntohl(message.event_id);
+    }
+
+    [[nodiscard]] uint16_t get_ticket_count() const {
+        return ntohs(message.ticket_count);
+    }
+};
+
+class TicketsRequest {
+private:
+    const GetTicketsMessage& message;
+
+public:
+    explicit TicketsRequest(const GetTicketsMessage& message) : message(message) {}
+
+    [[nodiscard]] uint32_t get_reservation_id() const {
+        return ntohl(message.reservation_id);
+    }
+
+    [[nodiscard]] const char* get_cookie() const {
+        return message.cookie;
+    }
+};
+
+class EventsPageRequest {
+private:
+    const GetEventsPageMessage& message;
+
+public:
+    explicit EventsPageRequest(const GetEventsPageMessage& message) : message(message) {}
+
+    [[nodiscard]] uint32_t get_first_event_id() const {
+        return ntohl(message.first_event_id);
+    }
+
+    [[nodiscard]] bool is_only_available() const {
+        return message.only_available != 0;
+    }
+};
+
+class EventsDeltaRequest {
+private:
+    const GetEventsDeltaMessage& message;
+
+public:
+    explicit EventsDeltaRequest(const GetEventsDeltaMessage& message) : message(message) {}
+
+    [[nodiscard]] uint64_t get_version() const {
+        return be64toh(message.version);
+    }
+};
+
+class TicketValidationRequest {
+private:
+    const ValidateTicketMessage& message;
+
+public:
+    explicit TicketValidationRequest(const ValidateTicketMessage& message) : message(message) {}
+
+    [[nodiscard]] const char* get_ticket() const {
+        return message.ticket;
+    }
+};
+
+struct __attribute__((__packed__)) ReservationMessage {
+    uint8_t message_id;
+    uint32_t reservation_id;
+    uint32_t event_id;
+    uint16_t ticket_count;
+    char cookie[COOKIE_LENGTH];
+    uint64_t expiration_time;
+};
+
+struct __attribute__((__packed__)) TicketsMessage {
+    uint8_t message_id;
+    uint32_t reservation_id;
+    uint16_t ticket_count;
+    char tickets[];
+};
+
+struct __attribute__((__packed__)) EventCount {
+    uint32_t event_id;
+    uint16_t ticket_count;
+};
+
+/*
+ *  Values of the full field of EVENTS_DELTA. A full listing holds the counts of events from the first one on. If
+ *  not all of them fit in a datagram it is marked truncated, and the rest is read with GET_EVENTS_PAGE starting
+ *  from the event after the last one listed.
+ */
+enum EventsDeltaKind : uint8_t {
+    DELTA_CHANGES = 0,
+    DELTA_FULL = 1,
+    DELTA_TRUNCATED = 2
+};
+
+struct __attribute__((__packed__)) EventsDeltaMessage {
+    uint8_t message_id;
+    uint8_t full;
+    uint64_t version;
+    EventCount counts[];
+};
+
+/*
+ *  Reply to VALIDATE_TICKET. The ticket is echoed, so that a scanner can match replies to its requests, and
+ *  the ids are zero for a ticket which is not valid.
+ */
+struct __attribute__((__packed__)) TicketStatusMessage {
+    uint8_t message_id;
+    char ticket[TICKET_LENGTH];
+    uint8_t valid;
+    uint32_t reservation_id;
+    uint32_t event_id;
+};
+
+struct __attribute__((__packed__)) BadRequestMessage {
+    uint8_t message_id;
+    uint32_t id;
+};
+
+#endif // TICKET_PROTOCOL_H
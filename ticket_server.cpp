@@ -3,267 +3,871 @@
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
+#include <cerrno>
 #include <vector>
-#include <fstream>
-#include <random>
+#include <array>
+#include <string_view>
 #include <ctime>
-#include <queue>
+#include <algorithm>
 #include <utility>
-#include <unordered_map>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <csignal>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/filter.h>
+
+#include "ticket_protocol.h"
+#include "ticket_controller.h"
+#include "latency_histogram.h"
+#include "allocation_counter.h"
+
+constexpr const char* USAGE_ERROR_MESSAGE =
+        "Usage: -f <path_to_events_file> [-p <port>] [-t <timeout>] [-b <batch_size>]"
+        " [-c <tickets_cache_size>]"
+        " [-r <retention>] [-w <workers>] [-s <snapshot_file>] [-j <journal_file>] [-d <durability>]"
+        " [-i <stats_interval>] [-o <trace_file>] [-n <trace_sample>] [-a <admin_port>]"
+        " [-l <rate_limits>] [-m <max_client_tickets>]\n";
+
+const uint32_t TRACE_RING_SIZE = 1 << 16;
+const uint8_t RATE_LIMIT_TABLE_BITS = 16;
+const uint32_t RATE_LIMIT_TABLE_SIZE = 1 << RATE_LIMIT_TABLE_BITS;
+const uint32_t RATE_LIMIT_PROBES = 8;
+const uint32_t TOKEN_SCALE = 1000;
+const uint8_t TICKETS_CACHE_TABLE_BITS = 16;
+const uint32_t TICKETS_CACHE_TABLE_SIZE = 1 << TICKETS_CACHE_TABLE_BITS;
+const uint32_t TICKETS_CACHE_PROBES = 8;
+const uint64_t SEND_BUFFER_SIZE = 1 << 20;
+const std::size_t SEND_ARENA_ALIGNMENT = 1 << 16;
+const int EVENT_LOOP_MAX_EVENTS = 8;
+const uint32_t RECEIVE_DRAIN_LIMIT = 64;
+const uint32_t IPV4_SOURCE_OFFSET = 12;
+const uint32_t CLIENT_HASH_MULTIPLIER = 2654435769u;
+
+/*
+ *  Memory every reply of a worker is serialized into, allocated once when the worker starts. The arena is
+ *  aligned to 64 KB and its size is rounded up to a multiple of that, so that a whole datagram written at its
+ *  start never straddles more pages than it has to.
+ */
+class SendArena {
+private:
+    char* memory;
+    std::size_t size;
 
-constexpr const char* USAGE_ERROR_MESSAGE = "Usage: -f <path_to_events_file> [-p <port>] [-t <timeout>]\n";
+public:
+    explicit SendArena(std::size_t size) {
+        this->size = (size + SEND_ARENA_ALIGNMENT - 1) / SEND_ARENA_ALIGNMENT * SEND_ARENA_ALIGNMENT;
+        memory = (char*) std::aligned_alloc(SEND_ARENA_ALIGNMENT, this->size);
 
-const uint16_t MIN_PORT = 0;
-const uint16_t MAX_PORT = 65535;
-const uint16_t DEFAULT_PORT = 2022;
+        if (memory == nullptr) {
+            std::cerr << "Could not allocate send arena\n";
+            exit(1);
+        }
+    }
 
-const uint32_t MIN_TIMEOUT = 1;
-const uint32_t MAX_TIMEOUT = 86400;
-const uint32_t DEFAULT_TIMEOUT = 5;
+    SendArena(const SendArena&) = delete;
 
-const uint8_t TICKET_CODE_BASE = 36;
-const uint8_t TICKET_LENGTH = 7;
-const uint8_t BEG_BIG_LETTERS = 'A';
-const uint8_t BEG_NUMBERS = '0';
-const uint8_t BEG_COOKIE = 33;
-const uint8_t END_COOKIE = 126;
-const uint8_t COOKIE_LENGTH = 48;
+    SendArena& operator=(const SendArena&) = delete;
 
-const uint32_t ID_LIMIT = 999999;
-const uint64_t UDP_DATAGRAM_MAX_SIZE = 65507;
+    ~SendArena() {
+        std::free(memory);
+    }
 
-struct ServerArgs {
-    std::string file_path;
-    uint16_t port = DEFAULT_PORT;
-    uint32_t timeout = DEFAULT_TIMEOUT;
-};
+    [[nodiscard]] char* data() const {
+        return memory;
+    }
 
-struct Event {
-    uint32_t event_id = 0;
-    std::string description;
-    uint16_t ticket_count = 0;
+    [[nodiscard]] std::size_t get_size() const {
+        return size;
+    }
 };
 
-enum MessageID : uint8_t {
-    GET_EVENTS = 1,
-    EVENTS = 2,
-    GET_RESERVATION = 3,
-    RESERVATION = 4,
-    GET_TICKETS = 5,
-    TICKETS = 6,
-    BAD_REQUEST = 255
-};
+/*
+ *  All replies go through the message sender. Without batching every message is sent right away with sendto.
+ *  In batched mode messages are copied into the send buffer and flushed together with a single sendmmsg after
+ *  the whole received batch has been handled, or earlier if the buffer or the batch runs out of space.
+ *  Messages which are built field by field can be written straight into the send buffer: get_message_buffer
+ *  returns space for a message of at most the given length and send_message_buffer sends what was written there.
+ */
+class MessageSender {
+private:
+    int socket_fd;
+    bool batched;
+    SendArena buffer;
+    std::size_t buffer_used = 0;
+    std::vector<sockaddr_in> addresses;
+    std::vector<iovec> vectors;
+    std::vector<mmsghdr> headers;
+    uint32_t pending_count = 0;
+    Journal* journal = nullptr;
 
-struct __attribute__((__packed__)) GetReservationMessage {
-    uint32_t event_id;
-    uint16_t ticket_count;
-};
+public:
+    MessageSender(int socket_fd, uint32_t batch_size) :
+            buffer(batch_size > 0 ? SEND_BUFFER_SIZE : UDP_DATAGRAM_MAX_SIZE) {
+        this->socket_fd = socket_fd;
+        batched = batch_size > 0;
+
+        if (batched) {
+            addresses.resize(batch_size);
+            vectors.resize(batch_size);
+            headers.resize(batch_size);
+        }
+    }
 
-struct __attribute__((__packed__)) GetTicketsMessage {
-    uint32_t reservation_id;
-    char cookie[COOKIE_LENGTH];
-};
+    [[nodiscard]] int get_socket_fd() const {
+        return socket_fd;
+    }
+
+    /*
+     *  Changes recorded in the journal are committed before any message is sent.
+     */
+    void set_journal(Journal* journal) {
+        this->journal = journal;
+    }
 
+    char* get_message_buffer(std::size_t length) {
+        if (!batched) return buffer.data();
 
-struct ReceivedMessage {
-    MessageID message_id;
-    union {
-        GetReservationMessage reservation_msg;
-        GetTicketsMessage tickets_msg;
-    };
+        if (pending_count == headers.size() || buffer_used + length > buffer.get_size()) {
+            flush();
+        }
+
+        return buffer.data() + buffer_used;
+    }
+
+    void send_message_buffer(const sockaddr_in *client_address, std::size_t length) {
+        if (!batched) {
+            send(client_address, buffer.data(), length);
+            return;
+        }
+
+        char* pointer_cpy = buffer.data() + buffer_used;
+        buffer_used += length;
+
+        addresses[pending_count] = *client_address;
+        vectors[pending_count].iov_base = pointer_cpy;
+        vectors[pending_count].iov_len = length;
+
+        mmsghdr& header = headers[pending_count];
+        header = mmsghdr{};
+        header.msg_hdr.msg_name = &addresses[pending_count];
+        header.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        header.msg_hdr.msg_iov = &vectors[pending_count];
+        header.msg_hdr.msg_iovlen = 1;
+
+        pending_count += 1;
+    }
+
+    void send(const sockaddr_in *client_address, const void *message, std::size_t length) {
+        if (!batched) {
+            if (journal != nullptr) journal->commit();
+            auto address_length = (socklen_t) sizeof(*client_address);
+            ssize_t sent_length = sendto(socket_fd, message, length, 0, (sockaddr*) client_address, address_length);
+
+            if (sent_length != (ssize_t) length) {
+                throw std::runtime_error("Sending message failed.");
+            }
+
+            return;
+        }
+
+        memcpy(get_message_buffer(length), message, length);
+        send_message_buffer(client_address, length);
+    }
+
+    void flush() {
+        uint32_t sent_count = 0;
+        if (journal != nullptr && pending_count > 0) journal->commit();
+
+        while (sent_count < pending_count) {
+            int ret = sendmmsg(socket_fd, headers.data() + sent_count, pending_count - sent_count, 0);
+
+            if (ret <= 0) {
+                throw std::runtime_error("Sending message failed.");
+            }
+
+            for (int i = 0; i < ret; i++) {
+                if (headers[sent_count + i].msg_len != vectors[sent_count + i].iov_len) {
+                    throw std::runtime_error("Sending message failed.");
+                }
+            }
+
+            sent_count += ret;
+        }
+
+        pending_count = 0;
+        buffer_used = 0;
+    }
 };
 
-struct __attribute__((__packed__)) ReservationMessage {
-    uint8_t message_id;
-    uint32_t reservation_id;
-    uint32_t event_id;
-    uint16_t ticket_count;
-    char cookie[COOKIE_LENGTH];
-    uint64_t expiration_time;
+/*
+ *  Cache of encoded TICKETS messages of collected reservations, limited by the total size of stored messages.
+ *  Clients may ask for their tickets many times, so a repeated GET_TICKETS is answered with the stored message.
+ *  The cache is only consulted after the controller has checked the cookie.
+ *  All memory is allocated when the cache is created, so caching a message allocates nothing. Messages are
+ *  written one after another into a circular buffer of the configured size, skipping its tail when a message
+ *  does not fit before the end, so the oldest messages are overwritten first. A hit on a message in the older half
+ *  of the buffer copies it to the front again, so a message asked for at least once per half of the buffer
+ *  written is never evicted, as in an LRU cache, while each message is copied at most once per such period.
+ *  Positions of messages are counted from the creation of the cache, which tells whether a message has been
+ *  overwritten since. Messages are found
+ *  through a fixed-size open-addressed table of reservation ids: an id probes TICKETS_CACHE_PROBES consecutive
+ *  slots, and a new one takes a slot whose message has been overwritten, or else the one with the oldest message.
+ */
+class TicketsCache {
+private:
+    struct Slot {
+        uint32_t reservation_id;
+        uint32_t length;
+        uint64_t position;
+    };
+
+    std::unique_ptr<char[]> buffer;
+    std::vector<Slot> slots;
+    uint64_t capacity;
+    uint64_t written = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    static std::size_t get_home(uint32_t reservation_id) {
+        return (reservation_id * 2654435769u) >> (32 - TICKETS_CACHE_TABLE_BITS);
+    }
+
+    [[nodiscard]] bool is_stored(const Slot& slot) const {
+        return slot.reservation_id != 0 && written - slot.position <= capacity;
+    }
+
+    /*
+     *  Returns the position of the written message. The message may lie in the buffer itself, as when a hit is
+     *  copied to the front, so the copy has to allow the two to overlap.
+     */
+    uint64_t append(const char* message, std::size_t length) {
+        uint64_t offset = written % capacity;
+        if (offset + length > capacity) written += capacity - offset;
+
+        uint64_t position = written;
+        memmove(buffer.get() + position % capacity, message, length);
+        written += length;
+
+        return position;
+    }
+
+public:
+    explicit TicketsCache(uint64_t capacity) {
+        this->capacity = capacity;
+
+        if (capacity > 0) {
+            buffer.reset(new char[capacity]);
+            slots.resize(TICKETS_CACHE_TABLE_SIZE);
+        }
+    }
+
+    [[nodiscard]] bool is_enabled() const {
+        return capacity > 0;
+    }
+
+    [[nodiscard]] uint64_t get_hits() const {
+        return hits;
+    }
+
+    [[nodiscard]] uint64_t get_misses() const {
+        return misses;
+    }
+
+    /*
+     *  Returns the stored message, or an empty view if there is none.
+     */
+    std::string_view find(uint32_t reservation_id) {
+        std::size_t home = get_home(reservation_id);
+
+        for (uint32_t i = 0; i < TICKETS_CACHE_PROBES; i++) {
+            Slot& slot = slots[(home + i) & (TICKETS_CACHE_TABLE_SIZE - 1)];
+
+            if (slot.reservation_id == reservation_id && is_stored(slot)) {
+                hits += 1;
+
+                if (written - slot.position > capacity / 2) {
+                    slot.position = append(buffer.get() + slot.position % capacity, slot.length);
+                }
+
+                return {buffer.get() + slot.position % capacity, slot.length};
+            }
+        }
+
+        misses += 1;
+
+        return {};
+    }
+
+    void insert(uint32_t reservation_id, const char* message, std::size_t length) {
+        if (length > capacity) return;
+
+        std::size_t home = get_home(reservation_id);
+        Slot* target = nullptr;
+
+        for (uint32_t i = 0; i < TICKETS_CACHE_PROBES; i++) {
+            Slot& slot = slots[(home + i) & (TICKETS_CACHE_TABLE_SIZE - 1)];
+            if (slot.reservation_id == reservation_id && is_stored(slot)) return;
+
+            if (target == nullptr || !is_stored(slot) || (is_stored(*target) && slot.position < target->position)) {
+                target = &slot;
+            }
+        }
+
+        *target = Slot{reservation_id, uint32_t (length), append(message, length)};
+    }
 };
 
-struct __attribute__((__packed__)) TicketsMessage {
-    uint8_t message_id;
-    uint32_t reservation_id;
-    uint16_t ticket_count;
-    char tickets[];
+/*
+ *  Token buckets of client addresses in a fixed-size open-addressed table, with a bucket for every class of
+ *  requests. A bucket holds up to one second worth of requests, counted in thousandths of a request, and is
+ *  refilled in proportion to the time since the address was last seen. An address probes RATE_LIMIT_PROBES
+ *  consecutive slots; if none of them is its own or free, it takes over the one idle for the longest time. The
+ *  table therefore never grows, and a flood of new addresses can only evict idle clients.
+ *  Every shard has its own limiter. Event listings and GET_RESERVATION of an address always go to the same
+ *  shard, so their limits hold for the whole server. GET_TICKETS is steered by its reservation id instead, so
+ *  an address which asks for reservations of all shards gets the GET_TICKETS limit once per shard.
+ */
+class RateLimiter {
+private:
+    struct Slot {
+        uint32_t address;
+        uint32_t refill_time;
+        std::array<uint32_t, RATE_LIMIT_CLASSES> tokens;
+    };
+
+    std::vector<Slot> slots;
+    std::array<uint32_t, RATE_LIMIT_CLASSES> limits;
+
+    static int get_limit_class(uint8_t message_id) {
+        switch (message_id) {
+            case MessageID::GET_EVENTS:
+            case MessageID::GET_EVENTS_PAGE:
+            case MessageID::GET_EVENTS_DELTA:
+                return LIMIT_EVENTS;
+            case MessageID::GET_RESERVATION:
+                return LIMIT_RESERVATIONS;
+            case MessageID::GET_TICKETS:
+                return LIMIT_TICKETS;
+            default:
+                return -1;
+        }
+    }
+
+    void reset_slot(Slot& slot, uint32_t address, uint32_t time) {
+        slot.address = address;
+        slot.refill_time = time;
+
+        for (uint8_t i = 0; i < RATE_LIMIT_CLASSES; i++) {
+            slot.tokens[i] = limits[i] * TOKEN_SCALE;
+        }
+    }
+
+    Slot& find_slot(uint32_t address, uint32_t time) {
+        uint32_t hash = (address * 2654435769u) >> (32 - RATE_LIMIT_TABLE_BITS);
+        Slot* idle_slot = nullptr;
+
+        for (uint32_t i = 0; i < RATE_LIMIT_PROBES; i++) {
+            Slot& slot = slots[(hash + i) & (RATE_LIMIT_TABLE_SIZE - 1)];
+            if (slot.address == address) return slot;
+
+            if (slot.address == 0) {
+                reset_slot(slot, address, time);
+                return slot;
+            }
+
+            if (idle_slot == nullptr || time - slot.refill_time > time - idle_slot->refill_time) idle_slot = &slot;
+        }
+
+        reset_slot(*idle_slot, address, time);
+
+        return *idle_slot;
+    }
+
+public:
+    explicit RateLimiter(const std::array<uint32_t, RATE_LIMIT_CLASSES>& limits) : limits(limits) {
+        for (uint32_t limit : limits) {
+            if (limit > 0) {
+                slots.resize(RATE_LIMIT_TABLE_SIZE);
+                break;
+            }
+        }
+    }
+
+    /*
+     *  Time is in milliseconds. Returns whether a request with the given message_id from the given address is
+     *  within its limit, and takes a token from its bucket if it is.
+     */
+    bool admit(uint32_t address, uint8_t message_id, uint32_t time) {
+        if (slots.empty()) return true;
+
+        int limit_class = get_limit_class(message_id);
+        if (limit_class < 0 || limits[limit_class] == 0) return true;
+
+        Slot& slot = find_slot(address, time);
+        uint64_t elapsed = time - slot.refill_time;
+        slot.refill_time = time;
+
+        for (uint8_t i = 0; i < RATE_LIMIT_CLASSES; i++) {
+            uint64_t tokens = slot.tokens[i] + elapsed * limits[i];
+            slot.tokens[i] = std::min<uint64_t>(tokens, limits[i] * TOKEN_SCALE);
+        }
+
+        if (slot.tokens[limit_class] < TOKEN_SCALE) return false;
+        slot.tokens[limit_class] -= TOKEN_SCALE;
+
+        return true;
+    }
 };
 
-struct __attribute__((__packed__)) BadRequestMessage {
-    uint8_t message_id;
-    uint32_t id;
+/*
+ *  Order in which a received batch is handled. GET_TICKETS goes first, since a late reply may cost the client
+ *  a reservation which is about to expire, and event listings, which clients poll and can afford to miss,
+ *  go last. Anything else is left to handle_message to drop.
+ */
+enum RequestPriority : uint8_t {
+    PRIORITY_TICKETS = 0,
+    PRIORITY_RESERVATIONS = 1,
+    PRIORITY_EVENTS = 2,
+    PRIORITY_OTHER = 3,
+    REQUEST_PRIORITIES = 4
 };
 
-std::vector<Event> get_events_from_file(const std::string& file_path);
-std::string generate_ticket_code(uint64_t ticket_number);
-std::string generate_cookie();
+RequestPriority get_request_priority(uint8_t message_id) {
+    switch (message_id) {
+        case MessageID::GET_TICKETS:
+        case MessageID::VALIDATE_TICKET:
+            return PRIORITY_TICKETS;
+        case MessageID::GET_RESERVATION:
+            return PRIORITY_RESERVATIONS;
+        case MessageID::GET_EVENTS:
+        case MessageID::GET_EVENTS_PAGE:
+        case MessageID::GET_EVENTS_DELTA:
+            return PRIORITY_EVENTS;
+        default:
+            return PRIORITY_OTHER;
+    }
+}
+
+/*
+ *  Indexes of the messages of a batch sorted by priority with a counting sort, which keeps the order of
+ *  arrival within every priority.
+ */
+class BatchClassifier {
+private:
+    std::vector<uint32_t> order;
+    std::vector<RequestPriority> priorities;
+    std::array<uint32_t, REQUEST_PRIORITIES> positions{};
+
+public:
+    explicit BatchClassifier(uint32_t batch_size) : order(batch_size), priorities(batch_size) {}
+
+    void classify(const std::vector<ReceivedMessage>& messages, uint32_t count) {
+        std::array<uint32_t, REQUEST_PRIORITIES> counts{};
+
+        for (uint32_t i = 0; i < count; i++) {
+            priorities[i] = get_request_priority(messages[i].message_id);
+            counts[priorities[i]] += 1;
+        }
+
+        uint32_t position = 0;
 
-class bad_request_exception: public std::exception {
-    [[nodiscard]] const char* what() const noexcept override {
-        return "Bad request\n";
+        for (uint8_t priority = 0; priority < REQUEST_PRIORITIES; priority++) {
+            positions[priority] = position;
+            position += counts[priority];
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            order[positions[priorities[i]]++] = i;
+        }
+    }
+
+    /*
+     *  Index in the batch of the message handled as the given one.
+     */
+    [[nodiscard]] uint32_t get_index(uint32_t position) const {
+        return order[position];
+    }
+
+    [[nodiscard]] RequestPriority get_priority(uint32_t index) const {
+        return priorities[index];
     }
 };
 
-class Reservation {
+/*
+ *  Counters and latency histograms of a single worker. They are only touched by the thread which owns them,
+ *  so recording needs neither locks nor atomics, and all memory is allocated up front. Latency is measured from
+ *  the moment a message (or the batch containing it) was received until its reply was sent.
+ */
+class ServerStats {
 private:
-    uint32_t reservation_id;
-    uint32_t event_id;
-    uint64_t first_ticket_number;
-    uint16_t ticket_count;
-    std::string cookie;
-    uint64_t expiration_time;
+    static const uint8_t LATENCY_TYPES = MessageID::VALIDATE_TICKET + 1;
+
+    std::array<uint64_t, 256> requests{};
+    std::array<uint64_t, BAD_REQUEST_REASONS> bad_requests{};
+    uint64_t malformed_requests = 0;
+    uint64_t rate_limited_requests = 0;
+    std::array<uint64_t, 256> shed_requests{};
+    std::vector<LatencyHistogram> latencies;
+    uint64_t start_time;
+    uint64_t start_allocations = 0;
+    mutable uint64_t report_allocations = 0;
+
+    static bool is_request(uint8_t message_id) {
+        return message_id == MessageID::GET_EVENTS || message_id == MessageID::GET_RESERVATION ||
+               message_id == MessageID::GET_TICKETS || message_id == MessageID::GET_EVENTS_PAGE ||
+               message_id == MessageID::GET_EVENTS_DELTA || message_id == MessageID::VALIDATE_TICKET;
+    }
 
 public:
-    Reservation(uint64_t timeout, uint32_t reservation_id, uint32_t event_id,
-                uint16_t ticket_count, uint64_t time) {
-        expiration_time = time + timeout;
-        this->reservation_id = reservation_id;
-        this->event_id = event_id;
-        this->first_ticket_number = 0;
-        this->ticket_count = ticket_count;
-        this->cookie = generate_cookie();
+    ServerStats() : latencies(LATENCY_TYPES) {
+        start_time = monotonic_time_ns();
+    }
+
+    void record_request(uint8_t message_id) {
+        requests[message_id] += 1;
     }
 
-    [[nodiscard]] uint32_t get_reservation_id() const {
-        return reservation_id;
+    void record_bad_request(BadRequestReason reason) {
+        bad_requests[reason] += 1;
     }
 
-    [[nodiscard]] uint32_t get_event_id() const {
-        return event_id;
+    void record_malformed_request() {
+        malformed_requests += 1;
     }
 
-    [[nodiscard]] uint64_t get_first_ticket_number() const {
-        return first_ticket_number;
+    void record_rate_limited_request() {
+        rate_limited_requests += 1;
     }
 
-    [[nodiscard]] uint16_t get_ticket_count() const {
-        return ticket_count;
+    void record_shed_request(uint8_t message_id) {
+        shed_requests[message_id] += 1;
     }
 
-    [[nodiscard]] const std::string& get_cookie() const {
-        return cookie;
+    void record_latency(uint8_t message_id, uint64_t latency) {
+        if (is_request(message_id)) latencies[message_id].record(latency);
+    }
+
+    /*
+     *  Allocations are counted from here on, which the worker calls once it has allocated everything it needs.
+     *  Allocations made by assembling the reports themselves are left out.
+     */
+    void start_counting_allocations() {
+        start_allocations = thread_allocations;
     }
 
-    [[nodiscard]] uint64_t get_expiration_time() const {
-        return expiration_time;
+    std::string get_report(const TicketController& ticket_controller, const TicketsCache& tickets_cache) const {
+        uint64_t report_start_allocations = thread_allocations;
+        uint64_t allocations = report_start_allocations - start_allocations - report_allocations;
+        std::ostringstream report;
+        uint64_t other_requests = 0;
+
+        report << "stats worker=" << ticket_controller.get_shard_index()
+               << " uptime_s=" << (monotonic_time_ns() - start_time) / 1000000000
+               << " reservations=" << ticket_controller.get_reservation_count()
+               << " expired=" << ticket_controller.get_expired_count()
+               << " retired=" << ticket_controller.get_retired_count()
+               << " allocations=" << allocations << "\n";
+
+        for (uint32_t message_id = 0; message_id < requests.size(); message_id++) {
+            if (!is_request(message_id)) {
+                other_requests += requests[message_id];
+                continue;
+            }
+
+            const LatencyHistogram& latency = latencies[message_id];
+            report << "  " << get_request_name(message_id) << " requests=" << requests[message_id];
+            if (shed_requests[message_id] > 0) report << " shed=" << shed_requests[message_id];
+
+            if (latency.get_count() > 0) {
+                report << " p50_us=" << latency.get_percentile(50) / 1000.0
+                       << " p99_us=" << latency.get_percentile(99) / 1000.0
+                       << " p999_us=" << latency.get_percentile(99.9) / 1000.0;
+            }
+
+            report << "\n";
+        }
+
+        report << "  other requests=" << other_requests << "\n  malformed requests=" << malformed_requests
+               << "\n  rate_limited requests=" << rate_limited_requests << "\n";
+
+        if (tickets_cache.is_enabled()) {
+            report << "  tickets_cache hits=" << tickets_cache.get_hits() << " misses=" << tickets_cache.get_misses()
+                   << "\n";
+        }
+
+        report << "  BAD_REQUEST";
+
+        for (uint8_t reason = 0; reason < BAD_REQUEST_REASONS; reason++) {
+            report << " " << BAD_REQUEST_REASON_NAMES[reason] << "=" << bad_requests[reason];
+        }
+
+        report << "\n";
+        std::string text = report.str();
+        report_allocations += thread_allocations - report_start_allocations;
+
+        return text;
     }
 
-    void set_first_ticket_number(uint64_t number) {
-        first_ticket_number = number;
+    /*
+     *  The report is assembled first and written at once, so reports of different workers do not interleave.
+     */
+    void dump(const TicketController& ticket_controller, const TicketsCache& tickets_cache) const {
+        std::cout << get_report(ticket_controller, tickets_cache) << std::flush;
     }
 };
 
-class TicketController {
+/*
+ *  Timestamps of a single sampled request. In batched mode received is shared by the whole batch and sent is
+ *  taken after the batch has been flushed, so the time a message waited for the ones handled before it shows
+ *  up between received and expired.
+ */
+struct TraceRecord {
+    uint64_t received;
+    uint64_t expired;
+    uint64_t handle_started;
+    uint64_t handled;
+    uint64_t sent;
+    uint8_t message_id;
+};
+
+/*
+ *  Ring of the last TRACE_RING_SIZE sampled requests of a single worker. Every trace_sample-th request is
+ *  sampled. The ring is only written and dumped by the thread which owns it, so it needs no synchronisation,
+ *  and a sampled request costs a few clock reads. The dump uses the Chrome trace event format, which both
+ *  chrome://tracing and Perfetto load.
+ */
+class RequestTracer {
 private:
-    std::queue<std::pair<uint32_t, uint64_t>> queue_reservations;
-    std::unordered_map<uint32_t, Reservation> reservations;
-    std::vector<Event> events;
-    uint64_t ticket_counter = 1;
-    uint32_t reservation_counter = ID_LIMIT + 1;
-    uint64_t timeout;
+    std::vector<TraceRecord> records;
+    uint64_t written = 0;
+    uint32_t sample;
+    uint32_t countdown;
+
+    static void write_slice(std::ostream& trace, bool& first, const char* name, uint64_t begin, uint64_t end,
+                            uint32_t thread_id) {
+        if (end <= begin) return;
+        if (!first) trace << ",\n";
+        first = false;
+
+        trace << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread_id
+              << ",\"ts\":" << begin / 1000.0 << ",\"dur\":" << (end - begin) / 1000.0 << "}";
+    }
 
 public:
-    explicit TicketController(const ServerArgs& server_args) {
-        timeout = server_args.timeout;
-        events = get_events_from_file(server_args.file_path);
+    explicit RequestTracer(uint32_t sample) {
+        this->sample = sample;
+        countdown = sample;
+        if (sample > 0) records.resize(TRACE_RING_SIZE);
     }
 
     /*
-     *  We store all reservations in reservation queue. After each message read inside the main loop, we get time and
-     *  check if the reservations are expired. If the time set for collecting the reservation have passed and
-     *  the reservation have not been collected, we remove it from the queue and map of reservations and return
-     *  tickets to the bank of available tickets. If reservation have been collected earlier, we remove it from the
-     *  queue, but not from the map.
+     *  Returns the record for the next request if it is sampled, or nullptr otherwise.
      */
-    void remove_expired_reservations(uint64_t time) {
-        while (!queue_reservations.empty()) {
-            auto reservation_pair = queue_reservations.front();
-            if (reservation_pair.second > time) break;
-            queue_reservations.pop();
-            Reservation& reservation = reservations.at(reservation_pair.first);
-            if (reservation.get_first_ticket_number() != 0) continue;
-            events[reservation.get_event_id()].ticket_count += reservation.get_ticket_count();
-            reservations.erase(reservation.get_reservation_id());
+    TraceRecord* sample_request(uint8_t message_id) {
+        if (sample == 0 || --countdown > 0) return nullptr;
+        countdown = sample;
+
+        TraceRecord& record = records[written & (TRACE_RING_SIZE - 1)];
+        written += 1;
+        record = TraceRecord{};
+        record.message_id = message_id;
+
+        return &record;
+    }
+
+    bool dump(const std::string& trace_path, uint32_t thread_id) const {
+        std::ofstream trace(trace_path);
+        if (!trace) return false;
+
+        uint64_t first_record = written > TRACE_RING_SIZE ? written - TRACE_RING_SIZE : 0;
+        bool first = true;
+        trace << std::fixed << "{\"traceEvents\":[\n";
+
+        for (uint64_t i = first_record; i < written; i++) {
+            const TraceRecord& record = records[i & (TRACE_RING_SIZE - 1)];
+            if (record.sent == 0) continue;
+
+            write_slice(trace, first, get_request_name(record.message_id), record.received, record.sent, thread_id);
+            write_slice(trace, first, "expiry", record.received, record.expired, thread_id);
+            write_slice(trace, first, "queue", record.expired, record.handle_started, thread_id);
+            write_slice(trace, first, "controller", record.handle_started, record.handled, thread_id);
+            write_slice(trace, first, "send", record.handled, record.sent, thread_id);
         }
+
+        trace << "\n]}\n";
+
+        return trace.good();
     }
+};
 
-    std::pair<std::vector<Event>, uint64_t> get_events() {
-        std::vector<Event> result;
-        uint64_t message_size = 0;
+/*
+ *  Room for the control message with the kernel receive timestamp of a single datagram.
+ */
+union ReceiveControl {
+    cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(timeval))];
+};
 
-        for (const auto& a: events) {
-            uint64_t event_size = 1 + 2 + 4 + a.description.length();
+/*
+ *  Returns the second in which the kernel received the datagram, taken from its SO_TIMESTAMP, or the fallback
+ *  if the datagram carries no timestamp.
+ */
+uint64_t get_arrival_time(msghdr* header, uint64_t fallback) {
+    if ((header->msg_flags & MSG_CTRUNC) != 0) return fallback;
 
-            if (message_size + event_size <= UDP_DATAGRAM_MAX_SIZE - 1) {
-                message_size += event_size;
-                result.push_back(a);
-            }
-            else {
-                break;
-            }
+    for (cmsghdr* control = CMSG_FIRSTHDR(header); control != nullptr; control = CMSG_NXTHDR(header, control)) {
+        if (control->cmsg_level != SOL_SOCKET || control->cmsg_type != SCM_TIMESTAMP) continue;
+
+        timeval timestamp{};
+        memcpy(&timestamp, CMSG_DATA(control), sizeof(timestamp));
+
+        return timestamp.tv_sec;
+    }
+
+    return fallback;
+}
+
+/*
+ *  Wall clock second from the coarse clock, which is served from the vDSO without a system call. It may lag
+ *  behind the precise clock by a kernel tick, which the worker covers by never going back behind a second it
+ *  has already seen.
+ */
+uint64_t get_coarse_time() {
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+    return now.tv_sec;
+}
+
+/*
+ *  Buffers recvmmsg receives a batch into, allocated once per worker and decoded in place. They serve as the
+ *  preallocated buffer ring, so io_uring provided-buffer rings were not adopted.
+ */
+struct ReceiveBatch {
+    std::vector<ReceivedMessage> messages;
+    std::vector<sockaddr_in> addresses;
+    std::vector<ReceiveControl> controls;
+    std::vector<iovec> vectors;
+    std::vector<mmsghdr> headers;
+
+    explicit ReceiveBatch(uint32_t batch_size) : messages(batch_size), addresses(batch_size), controls(batch_size),
+                                                 vectors(batch_size), headers(batch_size) {
+        for (uint32_t i = 0; i < batch_size; i++) {
+            vectors[i].iov_base = &messages[i];
+            vectors[i].iov_len = sizeof(ReceivedMessage);
+            headers[i].msg_hdr.msg_iov = &vectors[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+            headers[i].msg_hdr.msg_name = &addresses[i];
+            headers[i].msg_hdr.msg_control = &controls[i];
         }
+    }
 
-        return {result, message_size};
+    [[nodiscard]] std::size_t get_length(uint32_t i) const {
+        if ((headers[i].msg_hdr.msg_flags & MSG_TRUNC) != 0) return SIZE_MAX;
+        return headers[i].msg_len;
     }
 
-    Reservation get_reservation(GetReservationMessage message, uint64_t time) {
-        if (message.ticket_count == 0) throw bad_request_exception();
-        uint64_t cmp = TICKET_LENGTH * message.ticket_count + 7;
-        if (cmp > UDP_DATAGRAM_MAX_SIZE) throw bad_request_exception();
+    uint64_t get_arrival_time(uint32_t i, uint64_t fallback) {
+        return ::get_arrival_time(&headers[i].msg_hdr, fallback);
+    }
+};
 
-        try {
-            Event& event = events.at(message.event_id);
+/*
+ *  Readiness of the sockets of a single worker plus a timer for the once per second work. The timer fires on
+ *  whole seconds of the wall clock, when the time seen by the controller moves on, so an idle worker sleeps in
+ *  epoll_wait and wakes up only once per second. Signals interrupt the wait.
+ */
+class EventLoop {
+private:
+    int epoll_fd;
+    int timer_fd;
 
-            if (event.ticket_count < message.ticket_count) {
-                throw bad_request_exception();
-            }
-            else {
-                Reservation new_reservation(timeout, reservation_counter, message.event_id,
-                                            message.ticket_count, time);
-                event.ticket_count -= message.ticket_count;
-                reservation_counter += 1;
-                reservations.insert({new_reservation.get_reservation_id(), new_reservation});
-                queue_reservations.push({new_reservation.get_reservation_id(), new_reservation.get_expiration_time()});
+public:
+    EventLoop() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
 
-                return new_reservation;
-            }
+        if (epoll_fd == -1 || timer_fd == -1) {
+            std::cerr << "Could not create event loop\n";
+            exit(1);
         }
-        catch (std::out_of_range& e) {
-            throw bad_request_exception();
+
+        itimerspec schedule{};
+        schedule.it_value.tv_sec = std::time(nullptr) + 1;
+        schedule.it_interval.tv_sec = 1;
+
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &schedule, nullptr) == -1) {
+            std::cerr << "Could not start event loop timer\n";
+            exit(1);
         }
+
+        add(timer_fd);
     }
 
-    std::vector<std::string> get_tickets(GetTicketsMessage message) {
-        std::vector<std::string> tickets;
+    EventLoop(const EventLoop&) = delete;
 
-        try {
-            auto& reservation = reservations.at(message.reservation_id);
-            auto cookie_cmp = std::strncmp(message.cookie, reservation.get_cookie().c_str(), COOKIE_LENGTH);
+    EventLoop& operator=(const EventLoop&) = delete;
 
-            if (cookie_cmp == 0) {
-                tickets.reserve(reservation.get_ticket_count());
+    ~EventLoop() {
+        close(timer_fd);
+        close(epoll_fd);
+    }
 
-                if (reservation.get_first_ticket_number() == 0) {
-                    reservation.set_first_ticket_number(ticket_counter);
-                    ticket_counter += reservation.get_ticket_count();
-                }
+    void add(int fd) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
 
-                for (uint16_t i = 0; i < reservation.get_ticket_count(); i++) {
-                    tickets.push_back(generate_ticket_code(reservation.get_first_ticket_number() + i));
-                }
-            }
-            else {
-                throw bad_request_exception();
-            }
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            std::cerr << "Could not add socket to event loop\n";
+            exit(1);
         }
-        catch (std::out_of_range& e) {
-            throw bad_request_exception();
+    }
+
+    bool is_timer(int fd) const {
+        return fd == timer_fd;
+    }
+
+    /*
+     *  Returns the current wall clock second. Reading the clock rather than std::time avoids the coarse clock
+     *  behind it, which may still show the previous second right after the timer has fired.
+     */
+    uint64_t acknowledge_timer() {
+        uint64_t expirations;
+        timespec now{};
+
+        if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+            std::cerr << "Reading event loop timer failed. Terminating...\n";
+            exit(1);
+        }
+
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        return now.tv_sec;
+    }
+
+    /*
+     *  Returns the number of ready descriptors, or 0 when the wait was interrupted by a signal.
+     */
+    int wait(std::array<epoll_event, EVENT_LOOP_MAX_EVENTS>& events) {
+        int count = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+
+        if (count < 0 && errno != EINTR) {
+            std::cerr << "Waiting for events failed. Terminating...\n";
+            exit(1);
         }
 
-        return tickets;
+        return std::max(count, 0);
     }
 };
 
@@ -296,10 +900,42 @@ unsigned long parse_numeric_argument(const char* arg, const std::string& name, u
     return value;
 }
 
+std::array<uint32_t, RATE_LIMIT_CLASSES> parse_rate_limits(const char* arg) {
+    std::array<uint32_t, RATE_LIMIT_CLASSES> rate_limits{};
+    std::string limits(arg);
+    std::size_t position = 0;
+
+    for (uint8_t i = 0; i < RATE_LIMIT_CLASSES; i++) {
+        std::size_t separator = limits.find(',', position);
+
+        if ((i + 1 < RATE_LIMIT_CLASSES) == (separator == std::string::npos)) {
+            std::cerr << "rate_limits has to consist of " << int (RATE_LIMIT_CLASSES) << " comma separated limits.\n";
+            exit(1);
+        }
+
+        std::string limit = limits.substr(position, separator - position);
+        rate_limits[i] = parse_numeric_argument(limit.c_str(), "rate limit", 0, MAX_RATE_LIMIT);
+        position = separator + 1;
+    }
+
+    return rate_limits;
+}
+
 ServerArgs get_server_args(int argc, char** argv) {
     char* file;
     char* port;
     char* timeout;
+    char* batch_size;
+    char* tickets_cache_size;
+    char* retention;
+    char* workers;
+    char* snapshot;
+    char* journal;
+    char* durability;
+    char* stats_interval;
+    char* trace_sample;
+    char* admin_port;
+    char* max_client_tickets;
     int number_of_used_flags = 0;
     bool file_set = false;
 
@@ -308,7 +944,7 @@ ServerArgs get_server_args(int argc, char** argv) {
 
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "f:p:t:")) != -1) {
+    while ((c = getopt(argc, argv, "f:p:t:b:c:r:w:s:j:d:i:o:n:a:l:m:")) != -1) {
         switch (c) {
             case 'f': {
                 number_of_used_flags += 1;
@@ -339,84 +975,159 @@ ServerArgs get_server_args(int argc, char** argv) {
 
                 break;
             }
-            default: {
-                std::cerr << USAGE_ERROR_MESSAGE;
-                exit(1);
+            case 'b': {
+                number_of_used_flags += 1;
+                batch_size = optarg;
+                server_args.batch_size = parse_numeric_argument(batch_size, "batch_size",
+                                                                MIN_BATCH_SIZE, MAX_BATCH_SIZE);
+
+                break;
             }
-        }
-    }
+            case 'c': {
+                number_of_used_flags += 1;
+                tickets_cache_size = optarg;
+                server_args.tickets_cache_size = parse_numeric_argument(tickets_cache_size, "tickets_cache_size",
+                                                                        MIN_TICKETS_CACHE_SIZE,
+                                                                        MAX_TICKETS_CACHE_SIZE);
 
-    if ((argc - 1) > (number_of_used_flags * 2)) {
-        std::cerr << USAGE_ERROR_MESSAGE;
-        exit(1);
-    }
+                break;
+            }
+            case 'r': {
+                number_of_used_flags += 1;
+                retention = optarg;
+                server_args.retention = parse_numeric_argument(retention, "retention", MIN_RETENTION, MAX_RETENTION);
 
-    if (!file_set) {
-        std::cerr << USAGE_ERROR_MESSAGE;
-        exit(1);
-    }
+                break;
+            }
+            case 'w': {
+                number_of_used_flags += 1;
+                workers = optarg;
+                server_args.workers = parse_numeric_argument(workers, "workers", MIN_WORKERS, MAX_WORKERS);
 
-    return server_args;
-}
+                break;
+            }
+            case 's': {
+                number_of_used_flags += 1;
+                snapshot = optarg;
 
-std::vector<Event> get_events_from_file(const std::string& file_path) {
-    std::vector<Event> events;
-    std::string line;
-    std::ifstream file(file_path);
+                if (*snapshot == '\0') {
+                    std::cerr << "Error: snapshot_file can not be empty\n";
+                    exit(1);
+                }
 
-    while (getline(file, line)) {
-        Event event;
-        event.event_id = events.size();
-        event.description = line;
-        getline(file, line);
-        event.ticket_count = std::stoul(line, nullptr, 10);
-        events.push_back(event);
-    }
+                server_args.snapshot_path = snapshot;
 
-    file.close();
-    return events;
-}
+                break;
+            }
+            case 'j': {
+                number_of_used_flags += 1;
+                journal = optarg;
 
-std::string generate_ticket_code(uint64_t ticket_number) {
-    std::string code;
-    int length = TICKET_LENGTH;
+                if (*journal == '\0') {
+                    std::cerr << "Error: journal_file can not be empty\n";
+                    exit(1);
+                }
 
-    while (ticket_number > 0) {
-        uint64_t n = ticket_number / TICKET_CODE_BASE;
-        uint8_t r = ticket_number - (n * TICKET_CODE_BASE);
+                server_args.journal_path = journal;
 
-        if (r <= 9) {
-            code.push_back(char (r + BEG_NUMBERS));
-        }
-        else {
-            code.push_back(char (r + BEG_BIG_LETTERS - 10));
+                break;
+            }
+            case 'd': {
+                number_of_used_flags += 1;
+                durability = optarg;
+                server_args.durability = parse_numeric_argument(durability, "durability", JOURNAL_DURABILITY_WRITE,
+                                                                JOURNAL_DURABILITY_SYNC);
+
+                break;
+            }
+            case 'i': {
+                number_of_used_flags += 1;
+                stats_interval = optarg;
+                server_args.stats_interval = parse_numeric_argument(stats_interval, "stats_interval",
+                                                                    MIN_STATS_INTERVAL, MAX_STATS_INTERVAL);
+
+                break;
+            }
+            case 'o': {
+                number_of_used_flags += 1;
+
+                if (*optarg == '\0') {
+                    std::cerr << "Error: trace_file can not be empty\n";
+                    exit(1);
+                }
+
+                server_args.trace_path = optarg;
+
+                break;
+            }
+            case 'n': {
+                number_of_used_flags += 1;
+                trace_sample = optarg;
+                server_args.trace_sample = parse_numeric_argument(trace_sample, "trace_sample", MIN_TRACE_SAMPLE,
+                                                                  MAX_TRACE_SAMPLE);
+
+                break;
+            }
+            case 'a': {
+                number_of_used_flags += 1;
+                admin_port = optarg;
+                server_args.admin_port = parse_numeric_argument(admin_port, "admin_port", MIN_ADMIN_PORT,
+                                                                MAX_ADMIN_PORT);
+
+                break;
+            }
+            case 'l': {
+                number_of_used_flags += 1;
+                server_args.rate_limits = parse_rate_limits(optarg);
+
+                break;
+            }
+            case 'm': {
+                number_of_used_flags += 1;
+                max_client_tickets = optarg;
+                server_args.max_client_tickets = parse_numeric_argument(max_client_tickets, "max_client_tickets",
+                                                                        MIN_MAX_CLIENT_TICKETS,
+                                                                        MAX_MAX_CLIENT_TICKETS);
+
+                break;
+            }
+            default: {
+                std::cerr << USAGE_ERROR_MESSAGE;
+                exit(1);
+            }
         }
+    }
 
-        ticket_number = n;
-        length -= 1;
+    if ((argc - 1) > (number_of_used_flags * 2)) {
+        std::cerr << USAGE_ERROR_MESSAGE;
+        exit(1);
     }
 
-    while (length > 0) {
-        code.push_back(char (BEG_NUMBERS));
-        length -= 1;
+    if (!file_set) {
+        std::cerr << USAGE_ERROR_MESSAGE;
+        exit(1);
     }
 
-    return code;
-}
+    if (!server_args.snapshot_path.empty() && server_args.workers > 0) {
+        std::cerr << "Error: snapshot_file can not be used together with workers\n";
+        exit(1);
+    }
 
-std::string generate_cookie() {
-    std::string cookie(COOKIE_LENGTH, '\0');
-    std::mt19937 generator{std::random_device{}()};
-    std::uniform_int_distribution<int> distribution{BEG_COOKIE, END_COOKIE};
+    if (!server_args.journal_path.empty() && server_args.workers > 0) {
+        std::cerr << "Error: journal_file can not be used together with workers\n";
+        exit(1);
+    }
 
-    for (auto& c: cookie) {
-        c = char (distribution(generator));
+    if (server_args.admin_port > 0 && server_args.workers > 0 &&
+        server_args.admin_port + server_args.workers - 1 > MAX_ADMIN_PORT) {
+        std::cerr << "Error: admin ports of all workers must fit below " << MAX_ADMIN_PORT << "\n";
+        exit(1);
     }
 
-    return cookie;
+    return server_args;
 }
 
-int bind_socket(uint16_t port) {
+int bind_socket(uint16_t port, bool reuse_port, in_addr_t address = INADDR_ANY) {
     int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
 
     if (socket_fd <= 0) {
@@ -424,9 +1135,16 @@ int bind_socket(uint16_t port) {
         exit(1);
     }
 
+    int option = 1;
+
+    if (reuse_port && setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &option, sizeof(option)) == -1) {
+        std::cerr << "Could not set SO_REUSEPORT on socket\n";
+        exit(1);
+    }
+
     sockaddr_in server_address{};
     server_address.sin_family = AF_INET;
-    server_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    server_address.sin_addr.s_addr = htonl(address);
     server_address.sin_port = htons(port);
 
     auto ret = bind(socket_fd, (struct sockaddr *) &server_address, (socklen_t) sizeof(server_address));
@@ -439,184 +1157,871 @@ int bind_socket(uint16_t port) {
     return socket_fd;
 }
 
-void read_message(int socket_fd, sockaddr_in *client_address, ReceivedMessage *buffer) {
-    auto address_length = (socklen_t) sizeof(*client_address);
-    ssize_t len = recvfrom(socket_fd, buffer, sizeof(ReceivedMessage), 0, (sockaddr*) client_address, &address_length);
+/*
+ *  In multi-threaded mode every shard has its own socket in the SO_REUSEPORT group, added in the order of shard
+ *  indexes. The classic BPF program below picks the socket for every datagram: GET_TICKETS goes to the shard
+ *  which created the reservation, VALIDATE_TICKET to the shard which took the block of the ticket number, and
+ *  anything else to the shard picked by a multiplicative hash of the source address. Every client thus makes
+ *  its reservations in a single shard, so the per-client limits of a shard hold for the whole server.
+ *  The program sees the datagram starting from the UDP payload. Loads past the end of a short datagram make
+ *  the program return 0, so such datagrams go to the first shard, which ignores them. The ticket number is
+ *  decoded from the most significant digit down in 32-bit arithmetic, which is exact for the first 2^32
+ *  tickets; other characters than digits just make the ticket go to some shard, which finds it invalid.
+ */
+void attach_shard_steering(int socket_fd, uint32_t shard_count) {
+    std::vector<sock_filter> code = {
+            BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, MessageID::GET_TICKETS, 0, 4),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 1),
+            BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, ID_LIMIT + 1),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shard_count),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, MessageID::VALIDATE_TICKET, 5, 0),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t) (SKF_NET_OFF + IPV4_SOURCE_OFFSET)),
+            BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, CLIENT_HASH_MULTIPLIER),
+            BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shard_count),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+            BPF_STMT(BPF_LD | BPF_IMM, 0),
+            BPF_STMT(BPF_ST, 0),
+    };
+
+    for (uint8_t position = TICKET_LENGTH; position > 0; position--) {
+        code.insert(code.end(), {
+                BPF_STMT(BPF_LD | BPF_B | BPF_ABS, position),
+                BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 'A', 0, 2),
+                BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 'A' - 10),
+                BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+                BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, '0'),
+                BPF_STMT(BPF_MISC | BPF_TAX, 0),
+                BPF_STMT(BPF_LD | BPF_MEM, 0),
+                BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, TICKET_CODE_BASE),
+                BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+                BPF_STMT(BPF_ST, 0),
+        });
+    }
+
+    code.insert(code.end(), {
+            BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 1),
+            BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, TICKET_NUMBER_BLOCK),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shard_count),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+    });
+
+    sock_fprog program{};
+    program.len = code.size();
+    program.filter = code.data();
+
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+        std::cerr << "Could not attach shard steering program to socket\n";
+        exit(1);
+    }
+}
+
+/*
+ *  The kernel then stamps every datagram with the time it was received, so that the expiration time of
+ *  a reservation counts from the arrival of GET_RESERVATION even if the worker is behind with its queue.
+ */
+void enable_receive_timestamps(int socket_fd) {
+    int option = 1;
+
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_TIMESTAMP, &option, sizeof(option)) == -1) {
+        std::cerr << "Could not set SO_TIMESTAMP on socket\n";
+        exit(1);
+    }
+}
+
+bool is_socket_drained() {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+/*
+ *  Both readers never block. They return nothing once the socket is drained, and the worker goes back to
+ *  waiting for the event loop. The length of a datagram is its full length, even if it did not fit in
+ *  the buffer, so that too long requests can be told apart. The arrival time is left as it is if the datagram
+ *  carries no receive timestamp.
+ */
+bool read_message(int socket_fd, sockaddr_in *client_address, ReceivedMessage *buffer, std::size_t *length,
+                  uint64_t *arrival_time) {
+    iovec vector{buffer, sizeof(ReceivedMessage)};
+    ReceiveControl control{};
+    msghdr header{};
+    header.msg_name = client_address;
+    header.msg_namelen = sizeof(*client_address);
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = &control;
+    header.msg_controllen = sizeof(control);
+
+    ssize_t len = recvmsg(socket_fd, &header, MSG_DONTWAIT | MSG_TRUNC);
+
+    if (len < 0 && is_socket_drained()) return false;
 
     if (len < 0) {
         std::cerr << "Reading message failed. Terminating...\n";
         close(socket_fd);
         exit(1);
     }
-}
 
-void send_message(int socket_fd, const sockaddr_in *client_address, const void *message, std::size_t length) {
-    auto address_length = (socklen_t) sizeof(*client_address);
-    ssize_t sent_length = sendto(socket_fd, message, length, 0, (sockaddr*) client_address, address_length);
+    *length = len;
+    *arrival_time = get_arrival_time(&header, *arrival_time);
 
-    if (sent_length != (ssize_t) length) {
-        throw std::runtime_error("Sending message failed.");
-    }
+    return true;
 }
 
-GetReservationMessage change_reservation_endian(const GetReservationMessage& message) {
-    GetReservationMessage result{};
-    result.ticket_count = ntohs(message.ticket_count);
-    result.event_id = ntohl(message.event_id);
+/*
+ *  For a UDP socket FIONREAD gives the length of the next queued datagram, so this tells whether anything is
+ *  still waiting behind what has been read.
+ */
+bool has_queued_message(int socket_fd) {
+    int next_length = 0;
 
-    return result;
+    return ioctl(socket_fd, FIONREAD, &next_length) == 0 && next_length > 0;
 }
 
-GetTicketsMessage change_tickets_endian(const GetTicketsMessage& message) {
-    GetTicketsMessage result{};
-    result.reservation_id = ntohl(message.reservation_id);
-    memcpy(result.cookie, message.cookie, COOKIE_LENGTH);
+uint32_t read_messages(int socket_fd, ReceiveBatch *batch) {
+    for (auto& header : batch->headers) {
+        header.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        header.msg_hdr.msg_controllen = sizeof(ReceiveControl);
+        header.msg_len = 0;
+    }
 
-    return result;
+    int count = recvmmsg(socket_fd, batch->headers.data(), batch->headers.size(), MSG_DONTWAIT, nullptr);
+
+    if (count < 0 && is_socket_drained()) return 0;
+
+    if (count < 0) {
+        std::cerr << "Reading message failed. Terminating...\n";
+        close(socket_fd);
+        exit(1);
+    }
+
+    return count;
 }
 
-void send_events(const std::pair<std::vector<Event>, uint64_t>& events, int socket_fd,
+void send_events(const std::vector<char>& events_message, MessageSender& sender,
                  const sockaddr_in *client_address) {
-    char* message = new char[events.second + 1];
+    try {
+        sender.send(client_address, events_message.data(), events_message.size());
+    }
+    catch (std::runtime_error& e) {
+        std::cerr << e.what() << " Terminating...\n";
+        close(sender.get_socket_fd());
+        exit(1);
+    }
+}
+
+void mark_handled(TraceRecord* trace) {
+    if (trace != nullptr) trace->handled = monotonic_time_ns();
+}
 
-    *((uint8_t*)message) = MessageID::EVENTS;
-    char* pointer_cpy = message + 1;
+void send_events_page(const TicketController& ticket_controller, EventsPageRequest request,
+                      MessageSender& sender, const sockaddr_in *client_address, TraceRecord* trace) {
+    try {
+        char* events_msg = sender.get_message_buffer(UDP_DATAGRAM_MAX_SIZE);
+        std::size_t length = ticket_controller.write_events_page(request, events_msg);
+        mark_handled(trace);
+        sender.send_message_buffer(client_address, length);
+    }
+    catch (std::runtime_error& e) {
+        std::cerr << e.what() << " Terminating...\n";
+        close(sender.get_socket_fd());
+        exit(1);
+    }
+}
+
+void send_ticket_status(TicketValidationRequest request, const Reservation* reservation, MessageSender& sender,
+                        const sockaddr_in *client_address) {
+    TicketStatusMessage status_msg{};
+    status_msg.message_id = MessageID::TICKET_STATUS;
+    memcpy(status_msg.ticket, request.get_ticket(), TICKET_LENGTH);
 
-    for (const auto& event : events.first) {
-        *((uint32_t*)pointer_cpy) = htonl(event.event_id);
-        pointer_cpy += 4;
-        *((uint16_t*)pointer_cpy) = htons(event.ticket_count);
-        pointer_cpy += 2;
-        *((uint8_t*)pointer_cpy) = event.description.length();
-        pointer_cpy += 1;
-        memcpy(pointer_cpy, event.description.c_str(), event.description.length());
-        pointer_cpy += event.description.length();
+    if (reservation != nullptr) {
+        status_msg.valid = 1;
+        status_msg.reservation_id = htonl(reservation->get_reservation_id());
+        status_msg.event_id = htonl(reservation->get_event_id());
     }
 
     try {
-        send_message(socket_fd, client_address, message, events.second + 1);
+        sender.send(client_address, &status_msg, sizeof(status_msg));
     }
     catch (std::runtime_error& e) {
         std::cerr << e.what() << " Terminating...\n";
-        delete [] message;
-        close(socket_fd);
+        close(sender.get_socket_fd());
         exit(1);
     }
+}
 
-    delete [] message;
+void send_events_delta(TicketController& ticket_controller, EventsDeltaRequest request,
+                       MessageSender& sender, const sockaddr_in *client_address, TraceRecord* trace) {
+    try {
+        char* delta_msg = sender.get_message_buffer(UDP_DATAGRAM_MAX_SIZE);
+        std::size_t length = ticket_controller.write_events_delta(request, delta_msg);
+        mark_handled(trace);
+        sender.send_message_buffer(client_address, length);
+    }
+    catch (std::runtime_error& e) {
+        std::cerr << e.what() << " Terminating...\n";
+        close(sender.get_socket_fd());
+        exit(1);
+    }
 }
 
-void send_reservation(const Reservation& reservation, int socket_fd, const sockaddr_in *client_address) {
+void send_reservation(const Reservation& reservation, MessageSender& sender, const sockaddr_in *client_address) {
     ReservationMessage reservation_msg{};
     reservation_msg.message_id = MessageID::RESERVATION;
     reservation_msg.ticket_count = htons(reservation.get_ticket_count());
     reservation_msg.event_id = htonl(reservation.get_event_id());
     reservation_msg.reservation_id = htonl(reservation.get_reservation_id());
     reservation_msg.expiration_time = htobe64(reservation.get_expiration_time());
-    memcpy(reservation_msg.cookie, reservation.get_cookie().c_str(), COOKIE_LENGTH);
+    memcpy(reservation_msg.cookie, reservation.get_cookie(), COOKIE_LENGTH);
 
     try {
-        send_message(socket_fd, client_address, &reservation_msg, sizeof(reservation_msg));
+        sender.send(client_address, &reservation_msg, sizeof(reservation_msg));
     }
     catch (std::runtime_error& e) {
         std::cerr << e.what() << " Terminating...\n";
-        close(socket_fd);
+        close(sender.get_socket_fd());
         exit(1);
     }
 }
 
-void send_tickets(const std::vector<std::string>& tickets, uint32_t reservation_id, int socket_fd,
+void send_tickets(const Reservation& reservation, TicketsCache& tickets_cache, MessageSender& sender,
                   const sockaddr_in *client_address) {
-    auto tickets_msg = (TicketsMessage*) new char[tickets.size() * TICKET_LENGTH + 7];
-    tickets_msg->message_id = MessageID::TICKETS;
-    tickets_msg->reservation_id = reservation_id;
-    tickets_msg->ticket_count = htons(tickets.size());
+    std::size_t length = reservation.get_ticket_count() * TICKET_LENGTH + 7;
 
-    char* pointer_cpy = tickets_msg->tickets;
+    try {
+        if (tickets_cache.is_enabled()) {
+            std::string_view cached = tickets_cache.find(reservation.get_reservation_id());
 
-    for (const auto & ticket : tickets) {
-        memcpy(pointer_cpy, ticket.c_str(), TICKET_LENGTH);
-        pointer_cpy += TICKET_LENGTH;
-    }
+            if (!cached.empty()) {
+                sender.send(client_address, cached.data(), cached.size());
+                return;
+            }
+        }
 
-    try {
-        send_message(socket_fd, client_address, tickets_msg, tickets.size() * TICKET_LENGTH + 7);
+        auto tickets_msg = (TicketsMessage*) sender.get_message_buffer(length);
+        tickets_msg->message_id = MessageID::TICKETS;
+        tickets_msg->reservation_id = htonl(reservation.get_reservation_id());
+        tickets_msg->ticket_count = htons(reservation.get_ticket_count());
+        generate_ticket_codes(reservation.get_tickets(), tickets_msg->tickets);
+
+        if (tickets_cache.is_enabled()) {
+            tickets_cache.insert(reservation.get_reservation_id(), (const char*) tickets_msg, length);
+        }
+
+        sender.send_message_buffer(client_address, length);
     }
     catch (std::runtime_error& e) {
         std::cerr << e.what() << " Terminating...\n";
-        delete tickets_msg;
-        close(socket_fd);
+        close(sender.get_socket_fd());
         exit(1);
     }
-
-    delete tickets_msg;
 }
 
-void send_bad_request(uint32_t id, int socket_fd, const sockaddr_in *client_address) {
+void send_bad_request(uint32_t id, MessageSender& sender, const sockaddr_in *client_address) {
     BadRequestMessage bad_request_msg{};
     bad_request_msg.message_id = MessageID::BAD_REQUEST;
     bad_request_msg.id = id;
 
     try {
-        send_message(socket_fd, client_address, &bad_request_msg, sizeof(bad_request_msg));
+        sender.send(client_address, &bad_request_msg, sizeof(bad_request_msg));
     }
     catch (std::runtime_error& e) {
         std::cerr << e.what() << " Terminating...\n";
-        close(socket_fd);
+        close(sender.get_socket_fd());
         exit(1);
     }
 }
 
-int main(int argc, char** argv) {
-    ServerArgs server_args = get_server_args(argc, argv);
-    TicketController ticket_controller(server_args);
-    int socket_fd = bind_socket(server_args.port);
+/*
+ *  The request is decoded in place in the receive buffer. Requests of a wrong length are dropped without
+ *  a reply. If the message is traced, trace marks the point between the controller call and sending the reply.
+ *  Returns whether the message was answered.
+ */
+bool handle_message(TicketController& ticket_controller, TicketsCache& tickets_cache, MessageSender& sender,
+                    ServerStats& stats, const ReceivedMessage& received_message, std::size_t length,
+                    const sockaddr_in *client_address, uint64_t time, TraceRecord* trace) {
+    std::size_t request_length = get_request_length(received_message.message_id);
+
+    if (length == 0 || (request_length != 0 && length != request_length)) {
+        stats.record_malformed_request();
+        return false;
+    }
+
+    stats.record_request(received_message.message_id);
+    if (trace != nullptr) trace->handle_started = monotonic_time_ns();
+
+    switch (received_message.message_id) {
+        case MessageID::GET_EVENTS: {
+            const auto& events_message = ticket_controller.get_events();
+            mark_handled(trace);
+            send_events(events_message, sender, client_address);
+            break;
+        }
+        case MessageID::GET_EVENTS_PAGE: {
+            send_events_page(ticket_controller, EventsPageRequest(received_message.events_page_msg), sender,
+                             client_address, trace);
+            break;
+        }
+        case MessageID::GET_EVENTS_DELTA: {
+            send_events_delta(ticket_controller, EventsDeltaRequest(received_message.events_delta_msg), sender,
+                              client_address, trace);
+            break;
+        }
+        case MessageID::GET_RESERVATION: {
+            ReservationResult result = ticket_controller.get_reservation(
+                    ReservationRequest(received_message.reservation_msg), client_address->sin_addr.s_addr, time);
+            mark_handled(trace);
+
+            if (result.is_accepted()) {
+                send_reservation(result.get_reservation(), sender, client_address);
+            }
+            else {
+                stats.record_bad_request(result.get_reason());
+                send_bad_request(received_message.reservation_msg.event_id, sender, client_address);
+            }
+
+            break;
+        }
+        case MessageID::VALIDATE_TICKET: {
+            TicketValidationRequest request(received_message.validate_ticket_msg);
+            const Reservation* reservation = ticket_controller.validate_ticket(request);
+            mark_handled(trace);
+            send_ticket_status(request, reservation, sender, client_address);
+            break;
+        }
+        case MessageID::GET_TICKETS: {
+            ReservationResult result = ticket_controller.get_tickets(TicketsRequest(received_message.tickets_msg),
+                                                                     time);
+            mark_handled(trace);
+
+            if (result.is_accepted()) {
+                send_tickets(result.get_reservation(), tickets_cache, sender, client_address);
+            }
+            else {
+                stats.record_bad_request(result.get_reason());
+                send_bad_request(received_message.tickets_msg.reservation_id, sender, client_address);
+            }
+
+            break;
+        }
+        default: {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+volatile sig_atomic_t shutdown_requested = 0;
+std::atomic<uint32_t> trace_dump_requests{0};
+std::atomic<uint32_t> reload_requests{0};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "trace dump requests are counted in a signal handler");
+
+void request_shutdown(int) {
+    shutdown_requested = 1;
+}
+
+void request_trace_dump(int) {
+    trace_dump_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+void request_reload(int) {
+    reload_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ *  SIGHUP asks for the events file to be reloaded.
+ */
+void install_reload_handler() {
+    struct sigaction action{};
+    action.sa_handler = request_reload;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, nullptr);
+}
+
+/*
+ *  SIGUSR1 asks every worker to dump its trace ring. Workers notice the request on their next loop iteration.
+ */
+void install_trace_dump_handler() {
+    struct sigaction action{};
+    action.sa_handler = request_trace_dump;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, nullptr);
+}
+
+void dump_trace(const ServerArgs& server_args, const TicketController& ticket_controller,
+                const RequestTracer& tracer) {
+    std::string trace_path = server_args.trace_path;
+    if (server_args.workers > 0) trace_path += "." + std::to_string(ticket_controller.get_shard_index());
+
+    if (!tracer.dump(trace_path, ticket_controller.get_shard_index())) {
+        std::cerr << "Could not write trace file " << trace_path << "\n";
+    }
+}
+
+/*
+ *  With a snapshot file, SIGINT and SIGTERM stop the server gracefully. The handler only sets a flag, which the
+ *  main loop checks at least once per second, as epoll_wait returns early when interrupted by a signal.
+ */
+void install_shutdown_handlers() {
+    struct sigaction action{};
+    action.sa_handler = request_shutdown;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+std::string get_consumed_snapshot_path(const std::string& snapshot_path) {
+    return snapshot_path + ".consumed";
+}
+
+/*
+ *  Without a journal nothing records the changes made after a snapshot was restored, so a crash would roll the
+ *  server back to the same snapshot and reissue reservation ids and ticket numbers. The restored snapshot is
+ *  therefore renamed aside, and a server which finds only the renamed file refuses to start.
+ */
+void consume_snapshot(const std::string& snapshot_path) {
+    if (rename(snapshot_path.c_str(), get_consumed_snapshot_path(snapshot_path).c_str()) != 0) {
+        std::cerr << "Could not rename restored snapshot file\n";
+        exit(1);
+    }
+}
+
+[[noreturn]] void shut_down(const ServerArgs& server_args, const TicketController& ticket_controller, int socket_fd) {
+    close(socket_fd);
+
+    if (!ticket_controller.save_snapshot(server_args.snapshot_path)) {
+        std::cerr << "Could not write snapshot file\n";
+        exit(1);
+    }
+
+    unlink(get_consumed_snapshot_path(server_args.snapshot_path).c_str());
+
+    if (ticket_controller.get_journal() != nullptr) ticket_controller.get_journal()->restart();
+
+    std::cout << "Snapshot written to " << server_args.snapshot_path << "\n";
+    exit(0);
+}
+
+/*
+ *  Main loop of a single worker and the state it owns. The data socket is drained up to RECEIVE_DRAIN_LIMIT
+ *  messages per wake-up, so a busy socket can not starve the timer or the admin socket. Any datagram on the
+ *  admin socket is answered with the stats report.
+ */
+class Worker {
+private:
+    const ServerArgs& server_args;
+    TicketController& ticket_controller;
+    int socket_fd;
+    int admin_fd;
+    EventLoop event_loop;
+    MessageSender sender;
+    TicketsCache tickets_cache;
+    ServerStats stats;
+    RequestTracer tracer;
+    RateLimiter rate_limiter;
     ReceivedMessage received_message{};
     sockaddr_in client_address{};
+    ReceiveBatch batch;
+    std::vector<TraceRecord*> traces;
+    std::vector<bool> answered;
+    BatchClassifier classifier;
+    Journal* journal;
+    uint32_t trace_dumps;
+    uint32_t reloads;
+    std::future<std::unique_ptr<EventsFile>> reloaded_events;
+    uint64_t expiry_tick = 0;
+    uint64_t timer_tick = 0;
+    bool backlogged = false;
+    uint64_t next_stats_dump;
 
-    std::cout << "Initialization complete. Listening on port " << server_args.port << "\n";
+    /*
+     *  A message is handled at the second it arrived in, but never behind a second which has already been
+     *  ticked, since the reservations expired in it are gone.
+     */
+    uint64_t get_time(uint64_t arrival_time) const {
+        return std::max(arrival_time, expiry_tick);
+    }
+
+    /*
+     *  The once per second work, run by the timer or by the first message which arrived in a new second,
+     *  whichever comes first. Expired reservations are thus gone before any later message is handled. While
+     *  the socket has a backlog, only the arrival times of messages move the time on, so that messages which
+     *  waited in the queue see the reservations as they were when they arrived.
+     */
+    void tick(uint64_t time) {
+        if (time <= expiry_tick) return;
 
-    while (true) {
-        read_message(socket_fd, &client_address, &received_message);
-        uint64_t message_time = std::time(nullptr);
-        ticket_controller.remove_expired_reservations(message_time);
+        ticket_controller.remove_expired_reservations(time);
+        expiry_tick = time;
 
-        switch (received_message.message_id) {
-            case MessageID::GET_EVENTS: {
-                auto events = ticket_controller.get_events();
-                send_events(events, socket_fd, &client_address);
-                break;
+        if (journal != nullptr) {
+            journal->commit();
+            journal->sync_tick();
+        }
+
+        if (server_args.stats_interval > 0 && time >= next_stats_dump) {
+            stats.dump(ticket_controller, tickets_cache);
+            next_stats_dump = time + server_args.stats_interval;
+        }
+    }
+
+    /*
+     *  Rate limits are checked before any other work on the message.
+     */
+    bool admit(const ReceivedMessage& message, const sockaddr_in& address, uint64_t receive_time) {
+        if (rate_limiter.admit(address.sin_addr.s_addr, message.message_id, receive_time / 1000000)) return true;
+
+        stats.record_rate_limited_request();
+
+        return false;
+    }
+
+    /*
+     *  Both receivers return whether they have drained the socket. The clock is read once per call, for
+     *  datagrams without a receive timestamp.
+     */
+    bool receive_messages() {
+        uint64_t now = get_coarse_time();
+
+        for (uint32_t i = 0; i < RECEIVE_DRAIN_LIMIT; i++) {
+            std::size_t length;
+            uint64_t arrival_time = now;
+            if (!read_message(socket_fd, &client_address, &received_message, &length, &arrival_time)) return true;
+
+            uint64_t receive_time = monotonic_time_ns();
+            if (!admit(received_message, client_address, receive_time)) continue;
+
+            uint64_t message_time = get_time(arrival_time);
+            TraceRecord* trace = tracer.sample_request(received_message.message_id);
+            if (trace != nullptr) trace->received = receive_time;
+
+            tick(message_time);
+
+            if (trace != nullptr) trace->expired = monotonic_time_ns();
+
+            bool answered = handle_message(ticket_controller, tickets_cache, sender, stats, received_message, length,
+                                           &client_address, message_time, trace);
+            if (!answered) continue;
+
+            uint64_t send_time = monotonic_time_ns();
+            stats.record_latency(received_message.message_id, send_time - receive_time);
+            if (trace != nullptr) trace->sent = send_time;
+        }
+
+        return false;
+    }
+
+    /*
+     *  Every batch is handled in the order of priorities. The worker is overloaded when the batch is full and
+     *  more datagrams are already queued behind it, and then it sheds event listings without a reply. This is
+     *  checked for every batch, so a backlog is noticed in the batch that meets it.
+     *  There is no io_uring path: recvmmsg and sendmmsg already spread the system calls over a whole batch, and
+     *  liburing is not available on the machines the server is built on.
+     */
+    bool receive_batches() {
+        for (uint32_t received = 0; received < RECEIVE_DRAIN_LIMIT;) {
+            uint32_t count = read_messages(socket_fd, &batch);
+            if (count == 0) return true;
+
+            uint64_t receive_time = monotonic_time_ns();
+            uint64_t now = get_coarse_time();
+            bool overloaded = count == batch.headers.size() && has_queued_message(socket_fd);
+
+            classifier.classify(batch.messages, count);
+
+            for (uint32_t i = 0; i < count; i++) {
+                answered[i] = false;
+                traces[i] = nullptr;
             }
-            case MessageID::GET_RESERVATION: {
-                try {
-                    auto reservation = ticket_controller.get_reservation(
-                            change_reservation_endian(received_message.reservation_msg), message_time);
-                    send_reservation(reservation, socket_fd, &client_address);
-                }
-                catch (bad_request_exception& e) {
-                    send_bad_request(received_message.reservation_msg.event_id, socket_fd, &client_address);
+
+            for (uint32_t position = 0; position < count; position++) {
+                uint32_t i = classifier.get_index(position);
+                if (!admit(batch.messages[i], batch.addresses[i], receive_time)) continue;
+
+                if (overloaded && classifier.get_priority(i) == PRIORITY_EVENTS) {
+                    stats.record_shed_request(batch.messages[i].message_id);
+                    continue;
                 }
 
-                break;
+                uint64_t message_time = get_time(batch.get_arrival_time(i, now));
+                traces[i] = tracer.sample_request(batch.messages[i].message_id);
+                if (traces[i] != nullptr) traces[i]->received = receive_time;
+
+                tick(message_time);
+
+                if (traces[i] != nullptr) traces[i]->expired = monotonic_time_ns();
+
+                answered[i] = handle_message(ticket_controller, tickets_cache, sender, stats, batch.messages[i],
+                                             batch.get_length(i), &batch.addresses[i], message_time, traces[i]);
             }
-            case MessageID::GET_TICKETS: {
-                try {
-                    auto tickets = ticket_controller.get_tickets(
-                            change_tickets_endian(received_message.tickets_msg));
-                    send_tickets(tickets, received_message.tickets_msg.reservation_id,
-                                 socket_fd, &client_address);
-                }
-                catch (bad_request_exception& e) {
-                    send_bad_request(received_message.tickets_msg.reservation_id, socket_fd, &client_address);
-                }
 
-                break;
+            try {
+                sender.flush();
             }
-            default: {
-                break;
+            catch (std::runtime_error& e) {
+                std::cerr << e.what() << " Terminating...\n";
+                close(socket_fd);
+                exit(1);
             }
+
+            uint64_t send_time = monotonic_time_ns();
+
+            for (uint32_t i = 0; i < count; i++) {
+                if (!answered[i]) continue;
+
+                stats.record_latency(batch.messages[i].message_id, send_time - receive_time);
+                if (traces[i] != nullptr) traces[i]->sent = send_time;
+            }
+
+            if (count < batch.headers.size()) return true;
+            received += count;
         }
+
+        return false;
     }
 
-    return 0;
-}
\ No newline at end of file
+    /*
+     *  The events file is parsed on a separate thread, and the loop keeps serving until it is ready. Only
+     *  applying the parsed file, which touches every event once, happens between messages. A journal has no
+     *  record of a reload, so with a journal the reloaded state is written to the snapshot before it is applied
+     *  and a new journal is started after; without a snapshot a reload could not be replayed and is refused.
+     */
+    void start_reload() {
+        if (server_args.workers > 0) {
+            if (ticket_controller.get_shard_index() == 0) {
+                std::cerr << "Reloading events is not supported with workers\n";
+            }
+
+            return;
+        }
+
+        if (journal != nullptr && server_args.snapshot_path.empty()) {
+            std::cerr << "Reloading events needs a snapshot file when a journal is used\n";
+            return;
+        }
+
+        if (reloaded_events.valid()) return;
+
+        reloaded_events = std::async(std::launch::async, [this]() {
+            auto events_file = std::make_unique<EventsFile>();
+            if (!events_file->load(server_args.file_path)) events_file.reset();
+
+            return events_file;
+        });
+    }
+
+    /*
+     *  An events file which could not be loaded, or a snapshot which could not be written, leaves the current
+     *  events and the journal in place.
+     */
+    void finish_reload() {
+        std::unique_ptr<EventsFile> events_file = reloaded_events.get();
+
+        if (events_file == nullptr) {
+            std::cerr << "Could not reload events\n";
+            return;
+        }
+
+        std::vector<Event> reloaded = ticket_controller.plan_reload(events_file->get_events());
+
+        if (journal != nullptr && !ticket_controller.save_snapshot(server_args.snapshot_path, reloaded)) {
+            std::cerr << "Could not write snapshot file, events were not reloaded\n";
+            return;
+        }
+
+        ticket_controller.reload_events(reloaded);
+        if (journal != nullptr) journal->restart();
+
+        std::cout << "Reloaded " << events_file->get_events().size() << " events from " << server_args.file_path
+                  << std::endl;
+    }
+
+    void answer_admin_request() {
+        char request;
+        sockaddr_in admin_address{};
+        auto address_length = (socklen_t) sizeof(admin_address);
+
+        if (recvfrom(admin_fd, &request, sizeof(request), MSG_DONTWAIT, (sockaddr*) &admin_address,
+                     &address_length) < 0) {
+            return;
+        }
+
+        std::string report = stats.get_report(ticket_controller, tickets_cache);
+        sendto(admin_fd, report.data(), std::min<std::size_t>(report.size(), UDP_DATAGRAM_MAX_SIZE), 0,
+               (sockaddr*) &admin_address, address_length);
+    }
+
+public:
+    Worker(const ServerArgs& server_args, TicketController& ticket_controller, int socket_fd, int admin_fd)
+            : server_args(server_args), ticket_controller(ticket_controller), socket_fd(socket_fd),
+              admin_fd(admin_fd), sender(socket_fd, server_args.batch_size),
+              tickets_cache(server_args.tickets_cache_size),
+              tracer(server_args.trace_path.empty() ? 0 : server_args.trace_sample),
+              rate_limiter(server_args.rate_limits), batch(server_args.batch_size), traces(server_args.batch_size),
+              answered(server_args.batch_size), classifier(server_args.batch_size) {
+        journal = ticket_controller.get_journal();
+        sender.set_journal(journal);
+        trace_dumps = trace_dump_requests.load(std::memory_order_relaxed);
+        reloads = reload_requests.load(std::memory_order_relaxed);
+        next_stats_dump = std::time(nullptr) + server_args.stats_interval;
+
+        event_loop.add(socket_fd);
+        if (admin_fd != -1) event_loop.add(admin_fd);
+        stats.start_counting_allocations();
+    }
+
+    [[noreturn]] void run() {
+        std::array<epoll_event, EVENT_LOOP_MAX_EVENTS> events{};
+
+        while (true) {
+            if (shutdown_requested) shut_down(server_args, ticket_controller, socket_fd);
+
+            if (trace_dump_requests.load(std::memory_order_relaxed) != trace_dumps) {
+                trace_dumps = trace_dump_requests.load(std::memory_order_relaxed);
+                dump_trace(server_args, ticket_controller, tracer);
+            }
+
+            if (reload_requests.load(std::memory_order_relaxed) != reloads) {
+                reloads = reload_requests.load(std::memory_order_relaxed);
+                start_reload();
+            }
+
+            if (reloaded_events.valid() &&
+                reloaded_events.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                finish_reload();
+            }
+
+            int count = event_loop.wait(events);
+
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+
+                if (event_loop.is_timer(fd)) {
+                    timer_tick = event_loop.acknowledge_timer();
+                }
+                else if (fd == admin_fd) {
+                    answer_admin_request();
+                }
+                else if (server_args.batch_size == 0) {
+                    backlogged = !receive_messages();
+                }
+                else {
+                    backlogged = !receive_batches();
+                }
+            }
+
+            if (!backlogged) tick(timer_tick);
+        }
+    }
+};
+
+int bind_admin_socket(const ServerArgs& server_args, uint32_t shard_index) {
+    if (server_args.admin_port == 0) return -1;
+
+    return bind_socket(server_args.admin_port + shard_index, false, INADDR_LOOPBACK);
+}
+
+[[noreturn]] void serve(const ServerArgs& server_args, TicketController& ticket_controller, int socket_fd,
+                        int admin_fd) {
+    enable_receive_timestamps(socket_fd);
+
+    if (!server_args.snapshot_path.empty()) install_shutdown_handlers();
+    if (!server_args.trace_path.empty()) install_trace_dump_handler();
+    install_reload_handler();
+
+    Worker worker(server_args, ticket_controller, socket_fd, admin_fd);
+    worker.run();
+}
+
+/*
+ *  Multi-threaded mode. Every worker runs the usual loop on its own shard of the state and its own socket.
+ *  All sockets are bound before the steering program is attached and before any worker starts.
+ */
+[[noreturn]] void serve_sharded(const ServerArgs& server_args) {
+    EventsFile events_file(server_args.file_path);
+    const std::vector<Event>& events = events_file.get_events();
+    Inventory inventory(events, server_args.workers);
+    std::vector<std::unique_ptr<TicketController>> controllers;
+    std::vector<int> sockets;
+    std::vector<int> admin_sockets;
+
+    for (uint32_t i = 0; i < server_args.workers; i++) {
+        controllers.push_back(std::make_unique<TicketController>(server_args, events, i, server_args.workers,
+                                                                 &inventory));
+        sockets.push_back(bind_socket(server_args.port, true));
+        admin_sockets.push_back(bind_admin_socket(server_args, i));
+    }
+
+    attach_shard_steering(sockets[0], server_args.workers);
+
+    std::cout << "Initialization complete. Listening on port " << server_args.port << " with "
+              << server_args.workers << " workers\n";
+
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 0; i < server_args.workers; i++) {
+        threads.emplace_back(serve, std::cref(server_args), std::ref(*controllers[i]), sockets[i],
+                             admin_sockets[i]);
+    }
+
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    exit(0);
+}
+
+/*
+ *  Single-threaded mode. The state comes from the events file or the snapshot and is then brought up to date
+ *  with the journal, if one is used.
+ */
+[[noreturn]] void serve_single(const ServerArgs& server_args, TicketController& ticket_controller,
+                               uint64_t journal_generation) {
+    Journal journal(server_args.durability);
+
+    if (!server_args.journal_path.empty()) {
+        ticket_controller.open_journal(journal, server_args.journal_path, journal_generation);
+    }
+
+    int socket_fd = bind_socket(server_args.port, false);
+    int admin_fd = bind_admin_socket(server_args, 0);
+
+    std::cout << "Initialization complete. Listening on port " << server_args.port << "\n";
+
+    serve(server_args, ticket_controller, socket_fd, admin_fd);
+}
+
+int main(int argc, char** argv) {
+    ServerArgs server_args = get_server_args(argc, argv);
+
+    if (server_args.workers > 0) serve_sharded(server_args);
+
+    if (!server_args.snapshot_path.empty() && access(server_args.snapshot_path.c_str(), F_OK) == 0) {
+        SnapshotFile snapshot_file(server_args.snapshot_path);
+        TicketController ticket_controller(server_args, snapshot_file.get_events());
+        ticket_controller.restore_snapshot(snapshot_file);
+
+        if (server_args.journal_path.empty()) consume_snapshot(server_args.snapshot_path);
+
+        std::cout << "Restored " << snapshot_file.get_events().size() << " events from "
+                  << server_args.snapshot_path << "\n";
+
+        serve_single(server_args, ticket_controller, snapshot_file.get_header().journal_generation);
+    }
+
+    if (!server_args.snapshot_path.empty() && server_args.journal_path.empty() &&
+        access(get_consumed_snapshot_path(server_args.snapshot_path).c_str(), F_OK) == 0) {
+        std::cerr << "Error: the server stopped without writing a snapshot after restoring "
+                  << server_args.snapshot_path << ", its state is lost\n";
+        exit(1);
+    }
+
+    EventsFile events_file(server_args.file_path);
+    TicketController ticket_controller(server_args, events_file.get_events());
+
+    serve_single(server_args, ticket_controller, 0);
+}
@@ -0,0 +1,317 @@
+#include "ticket_controller.h"
+
+EventStore::EventStore(const std::vector<Event>& events) {
+    std::size_t arena_size = 0;
+
+    for (const auto& event: events) {
+        arena_size += event.description.length();
+    }
+
+    ticket_counts.reserve(events.size());
+    capacities.reserve(events.size());
+    deficits.reserve(events.size());
+    description_offsets.reserve(events.size());
+    description_lengths.reserve(events.size());
+    descriptions.reserve(arena_size);
+
+    for (const auto& event: events) {
+        append(event);
+    }
+}
+
+void EventStore::append(const Event& event) {
+    ticket_counts.push_back(event.ticket_count);
+    capacities.push_back(event.capacity);
+    deficits.push_back(event.deficit);
+    description_offsets.push_back(descriptions.size());
+    description_lengths.push_back(event.description.length());
+    descriptions.insert(descriptions.end(), event.description.begin(), event.description.end());
+}
+
+void ExpiryWheel::cascade(uint32_t* slot) {
+    uint32_t handle = *slot;
+    *slot = WHEEL_NO_NODE;
+
+    while (handle != WHEEL_NO_NODE) {
+        uint32_t next = nodes[handle].next;
+        link(handle);
+        handle = next;
+    }
+}
+
+ExpiryWheel::ExpiryWheel(uint64_t time) {
+    wheel_time = time;
+    nodes.reserve(RESERVATION_RING_MIN_SIZE);
+
+    for (auto& level : slots) {
+        for (auto& slot : level) {
+            slot = WHEEL_NO_NODE;
+        }
+    }
+}
+
+uint32_t ExpiryWheel::schedule(uint32_t reservation_id, uint64_t expiration_time) {
+    uint32_t handle;
+
+    if (free_nodes != WHEEL_NO_NODE) {
+        handle = free_nodes;
+        free_nodes = nodes[handle].next;
+    }
+    else {
+        handle = nodes.size();
+        nodes.emplace_back();
+    }
+
+    nodes[handle].reservation_id = reservation_id;
+    nodes[handle].expiration_time = std::max(expiration_time, wheel_time + 1);
+    link(handle);
+
+    return handle;
+}
+
+void ExpiryWheel::cancel(uint32_t handle) {
+    Node& node = nodes[handle];
+
+    if (node.prev != WHEEL_NO_NODE) {
+        nodes[node.prev].next = node.next;
+    }
+    else {
+        *get_slot(node.expiration_time) = node.next;
+    }
+
+    if (node.next != WHEEL_NO_NODE) nodes[node.next].prev = node.prev;
+
+    node.next = free_nodes;
+    free_nodes = handle;
+}
+
+void CookieGenerator::chacha_block(uint32_t* output) {
+    uint32_t x[CHACHA_BLOCK_WORDS];
+    memcpy(x, state, sizeof(x));
+
+    for (uint8_t i = 0; i < CHACHA_DOUBLE_ROUNDS; i++) {
+        quarter_round(x, 0, 4, 8, 12);
+        quarter_round(x, 1, 5, 9, 13);
+        quarter_round(x, 2, 6, 10, 14);
+        quarter_round(x, 3, 7, 11, 15);
+        quarter_round(x, 0, 5, 10, 15);
+        quarter_round(x, 1, 6, 11, 12);
+        quarter_round(x, 2, 7, 8, 13);
+        quarter_round(x, 3, 4, 9, 14);
+    }
+
+    for (uint8_t i = 0; i < CHACHA_BLOCK_WORDS; i++) {
+        output[i] = x[i] + state[i];
+    }
+
+    state[12] += 1;
+    if (state[12] == 0) state[13] += 1;
+}
+
+void CookieGenerator::refill() {
+    uint32_t block[CHACHA_BLOCK_WORDS];
+
+    for (std::size_t i = 0; i < sizeof(keystream); i += sizeof(block)) {
+        chacha_block(block);
+        memcpy((char*) keystream + i, block, sizeof(block));
+    }
+
+    for (uint32_t i = 0; i < COOKIE_CHARACTERS; i++) {
+        cookies[i] = char (BEG_COOKIE + ((uint32_t(keystream[i]) * (END_COOKIE - BEG_COOKIE + 1)) >> 16));
+    }
+
+    next_cookie = 0;
+}
+
+CookieGenerator::CookieGenerator() {
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    state[12] = 0;
+    state[13] = 0;
+
+    auto seed = (char*) &state[4];
+    std::size_t seed_length = 8 * sizeof(uint32_t);
+    std::size_t seeded = 0;
+
+    while (seeded < seed_length) {
+        ssize_t ret = getrandom(seed + seeded, seed_length - seeded, 0);
+
+        if (ret < 0 && errno != EINTR) {
+            std::cerr << "Could not seed cookie generator\n";
+            exit(1);
+        }
+
+        if (ret > 0) seeded += ret;
+    }
+
+    state[14] = 0;
+    state[15] = 0;
+}
+
+void CookieGenerator::generate_cookie(char* cookie) {
+    if (next_cookie == COOKIES_PER_REFILL) refill();
+    memcpy(cookie, cookies + next_cookie * COOKIE_LENGTH, COOKIE_LENGTH);
+    next_cookie += 1;
+}
+
+Reservation::Reservation(uint64_t timeout, uint32_t reservation_id, uint32_t event_id, uint16_t ticket_count,
+                         uint64_t time, const char* cookie, uint32_t client_address) {
+    expiration_time = time + timeout;
+    this->client_address = client_address;
+    this->reservation_id = reservation_id;
+    this->event_id = event_id;
+    this->tickets = TicketRange(0, ticket_count);
+    memcpy(this->cookie, cookie, COOKIE_LENGTH);
+    this->expiry_handle = WHEEL_NO_NODE;
+}
+
+void ReservationRing::grow() {
+    std::vector<Reservation> grown(std::max<std::size_t>(2 * records.size(), RESERVATION_RING_MIN_SIZE));
+
+    for (std::size_t i = 0; i < count; i++) {
+        grown[i] = at_offset(i);
+    }
+
+    records.swap(grown);
+    head = 0;
+}
+
+Reservation* ReservationRing::find_parked(uint32_t reservation_id) {
+    auto record = std::lower_bound(parked.begin(), parked.end(), reservation_id,
+                                   [](const ParkedRecord& record, uint32_t id) {
+                                       return record.reservation_id < id;
+                                   });
+    if (record == parked.end() || record->reservation_id != reservation_id) return nullptr;
+
+    return record->reservation.is_empty() ? nullptr : &record->reservation;
+}
+
+void ReservationRing::erase_parked(uint32_t reservation_id) {
+    Reservation* reservation = find_parked(reservation_id);
+    if (reservation == nullptr) return;
+
+    *reservation = Reservation();
+    parked_removed += 1;
+    live_count -= 1;
+
+    if (parked_removed > parked.size() / 2) {
+        parked.erase(std::remove_if(parked.begin(), parked.end(), [](const ParkedRecord& record) {
+            return record.reservation.is_empty();
+        }), parked.end());
+        parked_removed = 0;
+    }
+}
+
+Reservation& ReservationRing::insert(const Reservation& reservation) {
+    if (count == records.size()) grow();
+    Reservation& record = at_offset(count);
+    record = reservation;
+    count += 1;
+    if (!reservation.is_empty()) live_count += 1;
+
+    return record;
+}
+
+Reservation& ReservationRing::park(const Reservation& reservation) {
+    parked.push_back({reservation.get_reservation_id(), reservation});
+    live_count += 1;
+
+    return parked.back().reservation;
+}
+
+void ReservationRing::erase(uint32_t reservation_id) {
+    if (reservation_id < first_id) {
+        erase_parked(reservation_id);
+        return;
+    }
+
+    at_offset((reservation_id - first_id) / id_stride) = Reservation();
+    live_count -= 1;
+
+    while (count > 0 && (records[head].is_empty() || records[head].is_collected())) {
+        if (!records[head].is_empty()) parked.push_back({records[head].get_reservation_id(), records[head]});
+        head = (head + 1) & (records.size() - 1);
+        count -= 1;
+        first_id += id_stride;
+    }
+}
+
+void TicketIndex::sort() {
+    std::sort(entries.begin() + head, entries.end(), [](const Entry& entry, const Entry& other) {
+        return entry.first_number < other.first_number;
+    });
+}
+
+uint32_t TicketIndex::find(uint64_t ticket_number) const {
+    auto entry = std::upper_bound(entries.begin() + head, entries.end(), ticket_number,
+                                  [](uint64_t number, const Entry& entry) {
+                                      return number < entry.first_number;
+                                  });
+    if (entry == entries.begin() + head) return 0;
+
+    return std::prev(entry)->reservation_id;
+}
+
+Inventory::Inventory(const std::vector<Event>& events, uint32_t shard_count) :
+        slots(events.size()), versions(shard_count) {
+    for (const auto& event: events) {
+        slots[event.event_id].ticket_count.store(event.ticket_count, std::memory_order_relaxed);
+    }
+}
+
+uint64_t Inventory::get_version() const {
+    uint64_t version = 0;
+
+    for (const auto& shard_version: versions) {
+        version += shard_version.changes.load(std::memory_order_acquire);
+    }
+
+    return version;
+}
+
+bool Inventory::try_take(uint32_t event_id, uint16_t ticket_count, uint32_t shard_index) {
+    auto& available = slots[event_id].ticket_count;
+    uint16_t current = available.load(std::memory_order_relaxed);
+
+    do {
+        if (current < ticket_count) return false;
+    } while (!available.compare_exchange_weak(current, current - ticket_count, std::memory_order_relaxed));
+
+    mark_changed(shard_index);
+    return true;
+}
+
+std::size_t ClientHoldings::find(uint32_t address) const {
+    std::size_t index = get_home(address);
+
+    while (slots[index].address != 0 && slots[index].address != address) {
+        index = (index + 1) & (CLIENT_TABLE_SIZE - 1);
+    }
+
+    return index;
+}
+
+bool ClientHoldings::can_hold(uint32_t address, uint16_t ticket_count) const {
+    if (slots.empty() || address == 0) return true;
+
+    const Slot& slot = slots[find(address)];
+    if (slot.address == 0) return used < CLIENT_TABLE_MAX_USED && ticket_count <= limit;
+
+    return uint64_t(slot.tickets) + ticket_count <= limit;
+}
+
+void ClientHoldings::hold(uint32_t address, uint16_t ticket_count) {
+    if (slots.empty() || address == 0) return;
+
+    Slot& slot = slots[find(address)];
+
+    if (slot.address == 0) {
+        if (used == CLIENT_TABLE_MAX_USED) return;
+        slot.address = address;
+        used += 1;
+    }
+
+    slot.tickets += ticket_count;
+}